@@ -114,9 +114,16 @@ struct tlbshootdown {
 	 */
 	struct addrspace *ts_addrspace;
 	vaddr_t ts_vaddr;
+	struct semaphore *ts_done;	/* V'd once done, if not NULL */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/*
+ * Level-1 page table of the address space running on each cpu, for
+ * the fast TLB refill path in exception-mips1.S; 0 if none.
+ */
+extern vaddr_t cpurefill[];
+
 
 #endif /* _MIPS_VM_H_ */
@@ -28,6 +28,7 @@
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
@@ -36,6 +37,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
 
 /*
  * System call dispatcher.
@@ -81,6 +83,9 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_A3
+	uint32_t uarg;		/* argument fetched from the user stack */
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -139,6 +144,57 @@ syscall(struct trapframe *tf)
 			  (pid_t *)&retval);
 	  break;
 #endif
+#if OPT_A3
+	case SYS_sbrk:
+	  err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+	  break;
+	case SYS_mmap:
+	  // the offset is in the a2/a3 pair; the path is on the stack
+	  err = copyin((userptr_t)(tf->tf_sp + 16), &uarg, sizeof(uarg));
+	  if (err) {
+	    break;
+	  }
+	  err = sys_mmap((size_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 ((off_t)tf->tf_a2 << 32) | tf->tf_a3,
+			 (userptr_t)uarg,
+			 (vaddr_t *)&retval);
+	  break;
+	case SYS_munmap:
+	  err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	  break;
+	case SYS_mprotect:
+	  err = sys_mprotect((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			     (int)tf->tf_a2);
+	  break;
+	case SYS_madvise:
+	  err = sys_madvise((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			    (int)tf->tf_a2);
+	  break;
+	case SYS_mincore:
+	  err = sys_mincore((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			    (userptr_t)tf->tf_a2);
+	  break;
+	case SYS_mlock:
+	  err = sys_mlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1, true);
+	  break;
+	case SYS_munlock:
+	  err = sys_mlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1, false);
+	  break;
+	case SYS_getrlimit:
+	  err = sys_getrlimit((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+	  break;
+	case SYS_setrlimit:
+	  err = sys_setrlimit((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+	  break;
+	case SYS_sync:
+	  err = sys_sync();
+	  break;
+	case SYS___vmstat:
+	  err = sys___vmstat((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1,
+			     (int)tf->tf_a2, &retval);
+	  break;
+#endif
 #endif // UW
 
 	    /* Add stuff here */
@@ -30,15 +30,28 @@
 #include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
 #include <proc.h>
+#include <thread.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <copyinout.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <clock.h>
+#include <uw-vmstats.h>
+#include <platform/maxcpus.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -54,56 +67,360 @@
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
 #if OPT_A3
-// map vaddr to paddr and keep track of permissions
-//struct pagetable {
-//	vaddr_t vaddr;
-//	paddr_t paddr;
-//	bool readable;
-//	bool writable;
-//	bool executable;
-//};
-
-// coremap shoud store:
-// which frames are used and available
-// contiguous mem allocations
-struct coremap {
-	bool available;
-	int numContiguous;
-	paddr_t address;
+/*
+ * Evictions are done one batch at a time, of up to EVICT_BATCH pages
+ * that are shot down together. Besides keeping the disk queue short,
+ * this means each other cpu has at most one batch of shootdowns from
+ * us outstanding, so they can all share one semaphore to report back.
+ */
+#define EVICT_BATCH  8
+
+static struct lock *evict_lock;
+static struct semaphore *shootdown_sem;
+
+/* every address space there is, newest first, for vm_rssstats */
+static struct lock *aslist_lock;
+static struct addrspace *as_all;
+
+static int vm_evict(void);
+static paddr_t vm_compact(unsigned long npages);
+static void vm_merge_bootstrap(void);
+
+/*
+ * A kernel allocation of several frames that fails is worth a
+ * compaction when its fragmentation index (see coremap.h) is over
+ * this; below it, the memory just isn't there and eviction is the
+ * only thing that helps.
+ */
+#define COMPACT_FRAGINDEX  500
+
+/*
+ * Evicting single pages seldom frees a contiguous block, so a
+ * several-frame allocation only gets this many evictions to find room
+ * before it gives up. Single frames evict until there's nothing left.
+ */
+#define EVICT_TRIES_MULTI  16
+
+/*
+ * Hardware ASIDs are handed out in generations. An address space keeps
+ * its ASID for as long as the generation lasts; when they run out we
+ * start a new generation, and every cpu flushes its TLB the first time
+ * it activates an address space in the new one. ASID 0 is never used.
+ */
+#define ASID_MAX  (TLBHI_PID >> TLBHI_PIDSHIFT)
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1;
+static unsigned asid_next = 1;
+static uint32_t asid_cpugen[MAXCPUS];	/* generation each cpu last flushed */
+
+/* TLBHI for page VADDR of AS */
+static
+uint32_t
+as_tlbhi(struct addrspace *as, vaddr_t vaddr)
+{
+	return (vaddr & TLBHI_VPAGE) | (as->as_asid << TLBHI_PIDSHIFT);
+}
+
+/*
+ * Per-cpu TLB bookkeeping, so that vm_fault can find a slot without
+ * reading the TLB: a bitmap of slots known to be invalid, and a
+ * round-robin pointer for choosing a victim when there are none.
+ * The free bits are only hints - the refill handler's tlbwr doesn't
+ * update them - but overwriting a live entry is merely an early
+ * replacement, and vm_fault never inserts a page that's already there.
+ * Only touched at splhigh on the cpu itself.
+ */
+struct tlbinfo {
+	uint32_t ti_free[NUM_TLB / 32];	/* bit set: slot is invalid */
+	unsigned ti_nfree;
+	unsigned ti_victim;		/* next slot to replace */
 };
 
-struct coremap *coremap;
-bool coremapLoaded = false;
-int numFrames;
+static struct tlbinfo cputlb[MAXCPUS];
 
+/* Invalidate TLB slot I on this cpu. */
+static
 void
-vm_bootstrap(void)
+tlb_invalidate(int i)
+{
+	struct tlbinfo *ti = &cputlb[curcpu->c_number];
+
+	tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	if ((ti->ti_free[i / 32] & (1U << (i % 32))) == 0) {
+		ti->ti_free[i / 32] |= 1U << (i % 32);
+		ti->ti_nfree++;
+	}
+}
+
+/* Invalidate this cpu's whole TLB. */
+static
+void
+tlb_flush(void)
+{
+	struct tlbinfo *ti = &cputlb[curcpu->c_number];
+	unsigned w;
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	for (w = 0; w < NUM_TLB / 32; w++) {
+		ti->ti_free[w] = 0xffffffff;
+	}
+	ti->ti_nfree = NUM_TLB;
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+/*
+ * Pick the slot for a new entry on this cpu: a free one if we know of
+ * any, otherwise the round-robin victim. *REPLACE says which.
+ */
+static
+int
+tlb_getslot(bool *replace)
+{
+	struct tlbinfo *ti = &cputlb[curcpu->c_number];
+	unsigned w;
+	uint32_t bits;
+	int i;
+
+	if (ti->ti_nfree > 0) {
+		for (w = 0; ti->ti_free[w] == 0; w++) {
+			KASSERT(w < NUM_TLB / 32);
+		}
+		bits = ti->ti_free[w];
+		for (i = 0; (bits & (1U << i)) == 0; i++) {
+			/* nothing */
+		}
+		ti->ti_free[w] &= ~(1U << i);
+		ti->ti_nfree--;
+		i += w * 32;
+		// don't let the victim pointer evict what we just put in
+		if ((unsigned)i == ti->ti_victim) {
+			ti->ti_victim = (ti->ti_victim + 1) % NUM_TLB;
+		}
+		*replace = false;
+		return i;
+	}
+
+	i = ti->ti_victim;
+	ti->ti_victim = (ti->ti_victim + 1) % NUM_TLB;
+	*replace = true;
+	return i;
+}
+
+/*
+ * Page tables.
+ *
+ * Each address space has one two-level page table covering all of
+ * user space, indexed by the top and middle ten bits of the vaddr.
+ * The first level is allocated with the address space; a second-level
+ * table only once a page in its 4M has been touched, so the tables
+ * grow with what a process uses rather than with how spread out it is.
+ *
+ * Entries are TLBLO words. mips_utlb_handler walks the table of the
+ * address space running on its cpu (cpurefill[]) and loads any entry
+ * with TLBLO_VALID set straight into the TLB, so that bit must only
+ * ever be on for a resident page whose TLBLO_DIRTY is right. Clearing
+ * it is how anything that wants to see the next use of a page sends
+ * that use through vm_fault. The low byte, which the TLB never sees,
+ * says what the rest of the entry holds. Whether a page exists at all,
+ * and may be written, is up to the segment it's in (as_lookup), less
+ * whatever mprotect has taken away from the page.
+ *
+ * Entries only change under as_lock.
+ */
+#define PT_L1(va)  ((va) >> 22)
+#define PT_L2(va)  (((va) >> 12) & 0x3ff)
+#define PT_SIZE    1024
+
+#define PTE_RESIDENT  0x01	/* TLBLO_PPAGE is the page's frame */
+#define PTE_SWAPPED   0x02	/* PTE_SLOT() is the page's swap slot */
+#define PTE_COW       0x04	/* frame may be shared since fork */
+#define PTE_SHARED    0x08	/* frame is a mapped file's; never cow */
+#define PTE_LOCKED    0x10	/* mlock: the frame stays resident */
+#define PTE_SEQ       0x20	/* MADV_SEQUENTIAL: read ahead after it */
+#define PTE_NOWRITE   0x40	/* mprotect: read-only, whatever the seg */
+#define PTE_NOREAD    0x80	/* mprotect: no access; never TLBLO_VALID */
+#define PTE_SOFT      0xff
+
+/* what the program asked for about a page outlives whatever holds it */
+#define PTE_KEEP      (PTE_LOCKED | PTE_SEQ | PTE_NOWRITE | PTE_NOREAD)
+
+#define PTE_SLOT(pte)      ((int)((pte) >> 12))
+#define PTE_MKSLOT(slot)   (((uint32_t)(slot) << 12) | PTE_SWAPPED)
+#define PTE_PADDR(pte)     ((paddr_t)((pte) & TLBLO_PPAGE))
+
+vaddr_t cpurefill[MAXCPUS];
+
+/* One zeroed page for a level of a page table, or NULL. */
+static
+void *
+pt_getpage(void)
+{
+	paddr_t paddr;
+
+	paddr = coremap_alloc_zeroed(CM_PTABLE);
+	if (paddr == 0) {
+		return NULL;
+	}
+	return (void *)PADDR_TO_KVADDR(paddr);
+}
+
+/* Point this cpu's refill handler at AS (or nothing). */
+static
+void
+as_setrefill(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	cpurefill[curcpu->c_number] = (as == NULL) ? 0 : (vaddr_t)as->as_ptable;
+	splx(spl);
+}
+
+/*
+ * The page table entry for VADDR. If its second-level table doesn't
+ * exist yet, make it when CREATE is set; NULL otherwise, or if
+ * there's no memory for it.
+ */
+static
+uint32_t *
+as_pte(struct addrspace *as, vaddr_t vaddr, bool create)
+{
+	uint32_t *l2;
+
+	l2 = as->as_ptable[PT_L1(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = pt_getpage();
+		if (l2 == NULL) {
+			return NULL;
+		}
+		as->as_ptable[PT_L1(vaddr)] = l2;
+	}
+	return &l2[PT_L2(vaddr)];
+}
+
+/*
+ * Drop a reference to user frame PADDR, and with the last one the
+ * swap slot it may still match.
+ */
+static
+void
+frame_release(paddr_t paddr)
+{
+	int slot;
+
+	(void)coremap_getclean(paddr, &slot);
+	if (coremap_decref(paddr) == 0 && slot >= 0) {
+		swap_decref(slot);
+	}
+}
+
+/*
+ * Drop whatever frame or swap slot page *PTE of AS holds, leaving it
+ * untouched.
+ */
+static
+void
+pte_release(struct addrspace *as, uint32_t *pte)
+{
+	if (*pte & PTE_RESIDENT) {
+		frame_release(PTE_PADDR(*pte));
+		as->as_rss--;
+	} else if (*pte & PTE_SWAPPED) {
+		swap_decref(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+}
+
+/*
+ * Let page *PTE be written through the TLB. Its frame stops matching
+ * any copy elsewhere, so a swap slot kept for it can go.
+ */
+static
+void
+pte_dirty(uint32_t *pte)
 {
-	// call ram_getsize to get remaining physical mem
-	paddr_t lo, hi;
-	ram_getsize(&lo, &hi);
+	int slot;
+
+	KASSERT(*pte & PTE_RESIDENT);
+	if ((*pte & (PTE_SHARED | TLBLO_DIRTY)) == 0) {
+		slot = coremap_setdirty(PTE_PADDR(*pte));
+		if (slot >= 0) {
+			swap_decref(slot);
+		}
+	}
+	*pte |= TLBLO_DIRTY;
+}
 
-	// logically partition into fixed size frames
-	numFrames = (hi - lo) / PAGE_SIZE;
+/*
+ * Tell the coremap that the frame in *PTE holds page VPAGE of AS -
+ * unless the page is locked in memory. A frame without a recorded
+ * mapping is never picked for eviction.
+ */
+static
+void
+as_mapframe(struct addrspace *as, vaddr_t vpage, uint32_t *pte)
+{
+	coremap_map(PTE_PADDR(*pte), (*pte & PTE_LOCKED) ? NULL : as, vpage);
+}
 
-	// store coremap at start of ram_getsize
-	coremap = (struct coremap *)PADDR_TO_KVADDR(lo);
-	lo = ROUNDUP(lo + numFrames * (sizeof(struct coremap)), PAGE_SIZE);
+void
+as_unreference(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t *pte;
+	bool locked = false;
+	int i, spl;
 
-	// update usable frames
-	numFrames = (hi - lo) / PAGE_SIZE;
+	// we come from the coremap with a spinlock held, so can't wait
+	// for a fault in progress; the page just keeps its entry
+	if (!lock_do_i_hold(as->as_lock)) {
+		if (!lock_tryacquire(as->as_lock)) {
+			return;
+		}
+		locked = true;
+	}
+	pte = as_pte(as, vaddr, false);
+	if (pte != NULL) {
+		*pte &= ~TLBLO_VALID;
+	}
+	if (locked) {
+		lock_release(as->as_lock);
+	}
 
-	// initialize coremap
-	paddr_t page = lo;
-	for (int i = 0; i < numFrames; i++) {
-		coremap[i].available = true;
-		coremap[i].numContiguous = 0;
-		coremap[i].address = page;
-		page += PAGE_SIZE;
+	spl = splhigh();
+	i = tlb_probe(as_tlbhi(as, vaddr), 0);
+	if (i >= 0) {
+		tlb_invalidate(i);
 	}
+	splx(spl);
+}
 
-	// coremap has finished initialization
-	coremapLoaded = true;
+void
+vm_bootstrap(void)
+{
+	/* hand everything ram_stealmem hasn't taken to the frame manager */
+	coremap_bootstrap();
+	vmstats_init();
+
+	// as_cpus has a bit per cpu
+	KASSERT(MAXCPUS <= 32);
+
+	evict_lock = lock_create("evict");
+	shootdown_sem = sem_create("shootdown", 0);
+	aslist_lock = lock_create("aslist");
+	if (evict_lock == NULL || shootdown_sem == NULL ||
+	    aslist_lock == NULL) {
+		panic("vm_bootstrap: out of memory\n");
+	}
+	swap_bootstrap();
+	pagecache_bootstrap();
+	vm_merge_bootstrap();
 }
 #else
 void
@@ -118,51 +435,66 @@ paddr_t
 getppages(unsigned long npages)
 {
 	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
 #if OPT_A3
-	if (!coremapLoaded) {
-		// still starting up, just stealmem
-		addr = ram_stealmem(npages);
-		spinlock_release(&stealmem_lock);
-		return addr;
-	} else {
-		// must allocate a contiguous block
-		for (int i = 0; i < numFrames; i++) {
-			int start = i; // save starting index
-			bool canAlloc = true; // assume continuous block
-			if (coremap[i].available) {
-				// check next npages
-				for (int k = 0; k < (int)npages; k++) {
-					i = start + k;
-					if (i >= numFrames || !coremap[i].available) {
-						canAlloc = false;
-						break;
-					}
+	unsigned tries = 0;
+
+	if (coremap_ready()) {
+		addr = coremap_alloc(npages, CM_KERNEL);
+		// if we may sleep here, move user memory aside when it's
+		// only in the way, and page it out to make room
+		while (addr == 0 && !curthread->t_in_interrupt &&
+		       curthread->t_iplhigh_count == 0) {
+			if (npages > 1) {
+				// in pieces: compaction or nothing
+				if (coremap_fragindex(npages) >
+				    COMPACT_FRAGINDEX) {
+					addr = vm_compact(npages);
+					break;
 				}
-				// contiguous block found
-				if (canAlloc) {
-					for (int k = 0; k < (int)npages; k++) {
-						coremap[start + k].available = false;
-					}
-					coremap[start].numContiguous = (int)npages;
-					spinlock_release(&stealmem_lock);
-					return coremap[start].address;
+				// too little free: evict, but not forever
+				if (tries++ == EVICT_TRIES_MULTI) {
+					break;
 				}
 			}
+			if (vm_evict() != 0) {
+				break;
+			}
+			addr = coremap_alloc(npages, CM_KERNEL);
 		}
-		// could not allocate, out of mem
-		spinlock_release(&stealmem_lock);
-		return ENOMEM;
+		return addr;
 	}
-#else
+#endif
+
+	spinlock_acquire(&stealmem_lock);
+
 	addr = ram_stealmem(npages);
 
 	spinlock_release(&stealmem_lock);
 	return addr;
+}
+
+#if OPT_A3
+paddr_t
+getuserpage(bool zero)
+{
+	paddr_t paddr;
+
+	do {
+		paddr = zero ? coremap_alloc_zeroed(CM_USER) :
+			coremap_alloc(1, CM_USER);
+	} while (paddr == 0 && vm_evict() == 0);
+	return paddr;
+}
 #endif
+
+#if !OPT_A3
+static
+void
+as_zero_region(paddr_t paddr, unsigned npages)
+{
+	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
 }
+#endif
 
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t 
@@ -173,11 +505,6 @@ alloc_kpages(int npages)
 	if (pa==0) {
 		return 0;
 	}
-#if OPT_A3
-	else if (pa == ENOMEM) {
-		return ENOMEM;
-	}
-#endif
 	return PADDR_TO_KVADDR(pa);
 }
 
@@ -185,22 +512,8 @@ void
 free_kpages(vaddr_t addr)
 {
 #if OPT_A3
-	spinlock_acquire(&stealmem_lock);
-
-	if (coremapLoaded) {
-		for (int i = 0; i < numFrames; i++) {
-			if (addr == coremap[i].address) {
-				int npages = coremap[i].numContiguous;
-				coremap[i].numContiguous = 0;
-				for (int k = 0; k < npages; k++) {
-					coremap[i + k].available = true;
-				}
-				break;
-			}
-		}
-	}
-
-	spinlock_release(&stealmem_lock);
+	KASSERT(addr >= MIPS_KSEG0);
+	coremap_free(addr - MIPS_KSEG0);
 #else
 	/* nothing - leak the memory. */
 
@@ -208,104 +521,1266 @@ free_kpages(vaddr_t addr)
 #endif
 }
 
+#if OPT_A3
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int spl;
+
+	spl = splhigh();
+	tlb_flush();
+	splx(spl);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
-}
+	int i, spl;
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
-{
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
-	struct addrspace *as;
-	int spl;
+	// entries under an ASID the address space has since given up
+	// are never matched again before this cpu flushes its TLB
+	spl = splhigh();
+	i = tlb_probe(as_tlbhi(ts->ts_addrspace, ts->ts_vaddr), 0);
+	if (i >= 0) {
+		tlb_invalidate(i);
+	}
+	splx(spl);
 
-	faultaddress &= PAGE_FRAME;
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
+}
 
-	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+/*
+ * Remove the N pages in TS from every TLB in the system and wait until
+ * that has happened. Only cpus that have run the address spaces since
+ * they last changed ASID can have entries for them; the rest are left
+ * alone. Called with evict_lock held.
+ */
+static
+void
+vm_shootdown(struct tlbshootdown *ts, unsigned n)
+{
+	time_t secs, secs2;
+	uint32_t nsecs, nsecs2, cpus;
+	unsigned i, sent, skipped;
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-#if OPT_A3
-		// kill the current process, don't panic
-		return EINVAL;
-#else
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
-#endif
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
-		return EINVAL;
-	}
+	KASSERT(lock_do_i_hold(evict_lock));
+	KASSERT(n > 0 && n <= TLBSHOOTDOWN_MAX);
 
-	if (curproc == NULL) {
-		/*
-		 * No process. This is probably a kernel fault early
-		 * in boot. Return EFAULT so as to panic instead of
-		 * getting into an infinite faulting loop.
-		 */
-		return EFAULT;
+	cpus = 0;
+	spinlock_acquire(&asid_lock);
+	for (i = 0; i < n; i++) {
+		cpus |= ts[i].ts_addrspace->as_cpus;
 	}
+	spinlock_release(&asid_lock);
 
-	as = curproc_getas();
-	if (as == NULL) {
-		/*
-		 * No address space set up. This is probably also a
-		 * kernel fault early in boot.
-		 */
-		return EFAULT;
+	for (i = 0; i < n; i++) {
+		ts[i].ts_done = NULL;
+		vm_tlbshootdown(&ts[i]);
 	}
 
-#if OPT_A3
-	vbase1 = as->as_text_vbase;
-        vtop1 = vbase1 + as->as_text_npages * PAGE_SIZE;
-	vbase2 = as->as_data_vbase;
-	vtop2 = vbase2 + as->as_data_npages * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-	bool readOnly = false;
-	
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		vaddr_t vframe = (faultaddress - vbase1) / PAGE_SIZE; 
-		paddr = (faultaddress - vbase1) + as->as_text_ptable[vframe].paddr;
-		readOnly = !as->as_text_ptable[vframe].writeable;
-	} else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		vaddr_t vframe = (faultaddress - vbase2) / PAGE_SIZE;
-		paddr = (faultaddress - vbase2) + as->as_data_ptable[vframe].paddr;
-		readOnly = !as->as_data_ptable[vframe].writeable;
-	} else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		vaddr_t vframe = (faultaddress - stackbase) / PAGE_SIZE;
-		paddr = (faultaddress - stackbase) + as->as_stack_ptable[vframe].paddr;
-		readOnly = !as->as_stack_ptable[vframe].writeable;
-	} else {
-	        return EFAULT;
+	// the others report back once, after the last page
+	gettime(&secs, &nsecs);
+	ts[n - 1].ts_done = shootdown_sem;
+	sent = ipi_tlbshootdown_cpus(cpus, ts, n, &skipped);
+	for (i = 0; i < sent; i++) {
+		P(shootdown_sem);
 	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs, nsecs, secs2, nsecs2, &secs2, &nsecs2);
+
+	vmstats_inc(VMSTAT_SHOOTDOWN);
+	vmstats_add(VMSTAT_SHOOTDOWN_PAGE, n);
+	vmstats_add(VMSTAT_SHOOTDOWN_IPI, sent);
+	vmstats_add(VMSTAT_SHOOTDOWN_SKIP, skipped);
+	vmstats_add(VMSTAT_SHOOTDOWN_USEC, secs2 * 1000000 + nsecs2 / 1000);
+}
 #else
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+#endif
+
+#if OPT_A3
+/*
+ * Get rid of every TLB entry of the current address space AS, on every
+ * cpu, by moving it to a new ASID. The old entries are never matched
+ * again, and are gone once the ASIDs roll over. Much cheaper than
+ * shooting pages down one by one when a lot of them change at once,
+ * but there are few ASIDs and each rollover flushes every TLB, so it's
+ * only for that (see tlbbatch_flush).
+ */
+static
+void
+as_tlbreset(struct addrspace *as)
+{
+	KASSERT(as == curproc_getas());
+
+	as->as_asidgen = 0;
+	as_activate();
+}
+
+/*
+ * Pages of one address space whose TLB entries have to go after a
+ * change to its page table. They're collected as the table changes
+ * and flushed once it's done: shot down EVICT_BATCH at a time if there
+ * are no more than TLBRESET_PAGES of them, by as_tlbreset if there
+ * are. Past a couple of rounds of shootdowns a new ASID is cheaper,
+ * and the batch lives on the kernel stack.
+ */
+#define TLBRESET_PAGES  (2 * EVICT_BATCH)
+
+struct tlbbatch {
+	struct addrspace *tb_as;
+	unsigned tb_n;		/* pages added, possibly past the array */
+	struct tlbshootdown tb_ts[TLBRESET_PAGES];
+};
+
+static
+void
+tlbbatch_init(struct tlbbatch *tb, struct addrspace *as)
+{
+	tb->tb_as = as;
+	tb->tb_n = 0;
+}
+
+static
+void
+tlbbatch_add(struct tlbbatch *tb, vaddr_t vaddr)
+{
+	if (tb->tb_n < TLBRESET_PAGES) {
+		tb->tb_ts[tb->tb_n].ts_addrspace = tb->tb_as;
+		tb->tb_ts[tb->tb_n].ts_vaddr = vaddr;
+	}
+	tb->tb_n++;
+}
+
+/*
+ * Flush TB's pages. Past TLBRESET_PAGES the address space must be the
+ * current one. May be called with its as_lock held.
+ */
+static
+void
+tlbbatch_flush(struct tlbbatch *tb)
+{
+	unsigned i, n;
+
+	if (tb->tb_n > TLBRESET_PAGES) {
+		as_tlbreset(tb->tb_as);
+	} else if (tb->tb_n > 0) {
+		lock_acquire(evict_lock);
+		for (i = 0; i < tb->tb_n; i += n) {
+			n = tb->tb_n - i;
+			if (n > EVICT_BATCH) {
+				n = EVICT_BATCH;
+			}
+			vm_shootdown(&tb->tb_ts[i], n);
+		}
+		lock_release(evict_lock);
+	}
+	tb->tb_n = 0;
+}
+
+/*
+ * Give the page at VPAGE, whose entry is PTE, its first frame.
+ * Whatever part of the page SRC says is backed by the executable is
+ * read from the file; everything else is zero. Read-only pages that
+ * are all file come from the page cache instead, so that everyone
+ * running the same program shares one copy; they're marked cow, which
+ * keeps them read-only in the TLB. FAULT says whether the page is
+ * being used right now or only brought in ahead of time.
+ */
+static
+int
+as_load_page(struct addrspace *as, struct segsource *src, vaddr_t vpage,
+	     bool writeable, uint32_t *pte, bool fault)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t lo, hi;
+	paddr_t paddr;
+	off_t offset;
+	bool read;
+	int result;
+
+	lo = hi = 0;
+	if (src != NULL && src->ss_filesz > 0) {
+		lo = vpage > src->ss_vaddr ? vpage : src->ss_vaddr;
+		hi = src->ss_vaddr + src->ss_filesz;
+		if (hi > vpage + PAGE_SIZE) {
+			hi = vpage + PAGE_SIZE;
+		}
+	}
+
+	offset = 0;
+	if (lo < hi) {
+		offset = src->ss_offset + (lo - src->ss_vaddr);
+	}
+	if (!writeable && lo == vpage && hi == vpage + PAGE_SIZE &&
+	    offset % PAGE_SIZE == 0) {
+		result = pagecache_get(as->as_vnode, offset, &paddr, &read);
+		if (result) {
+			return result;
+		}
+		if (read) {
+			vmstats_inc(fault ? VMSTAT_PAGE_FAULT_DISK :
+				    VMSTAT_PAGE_PREFETCH);
+			vmstats_inc(VMSTAT_ELF_FILE_READ);
+		} else if (fault) {
+			// another process running this program has it
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+		}
+		*pte = paddr | PTE_RESIDENT | PTE_COW | (*pte & PTE_KEEP);
+		return 0;
+	}
+
+	// no bzero here if an idle cpu got to it first
+	paddr = getuserpage(true);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	if (lo >= hi) {
+		// nothing from the file: bss, or the tail of the data seg
+		vmstats_inc(fault ? VMSTAT_PAGE_FAULT_ZERO :
+			    VMSTAT_PAGE_PREFETCH);
+		coremap_setclean(paddr, -1);
+		coremap_map(paddr, as, vpage);
+		*pte = paddr | PTE_RESIDENT | (*pte & PTE_KEEP);
+		return 0;
+	}
+
+	KASSERT(as->as_vnode != NULL);
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + (lo - vpage)),
+		  hi - lo, offset, UIO_READ);
+	result = VOP_READ(as->as_vnode, &ku);
+	if (result) {
+		coremap_decref(paddr);
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("ELF: short read on segment - file truncated?\n");
+		coremap_decref(paddr);
+		return ENOEXEC;
+	}
+
+	vmstats_inc(fault ? VMSTAT_PAGE_FAULT_DISK : VMSTAT_PAGE_PREFETCH);
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+	coremap_setclean(paddr, -1);
+	coremap_map(paddr, as, vpage);
+	*pte = paddr | PTE_RESIDENT | (*pte & PTE_KEEP);
+	return 0;
+}
+
+/*
+ * First write to a page shared copy-on-write. If nobody else holds
+ * the frame any more we just take it over; otherwise copy it, and add
+ * VPAGE to TB: other cpus may still map the shared frame read-only
+ * under our ASID, and must lose that entry before we run there again.
+ */
+static
+int
+as_break_cow(struct addrspace *as, vaddr_t vpage, uint32_t *pte,
+	     struct tlbbatch *tb)
+{
+	paddr_t paddr;
+
+	KASSERT((*pte & (PTE_RESIDENT | PTE_COW)) == (PTE_RESIDENT | PTE_COW));
+
+	paddr = PTE_PADDR(*pte);
+	if (coremap_refcount(paddr) > 1) {
+		paddr = getuserpage(false);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		memcpy((void *)PADDR_TO_KVADDR(paddr),
+		       (const void *)PADDR_TO_KVADDR(PTE_PADDR(*pte)),
+		       PAGE_SIZE);
+		frame_release(PTE_PADDR(*pte));
+		tlbbatch_add(tb, vpage);
+	}
+	*pte = paddr | PTE_RESIDENT | (*pte & PTE_KEEP);
+	as_mapframe(as, vpage, pte);
+	return 0;
+}
+#endif
+
+#if OPT_A3
+static unsigned faultaround = 0;	/* pages either side; 0 is off */
+
+/* pages brought in after a fault in an MADV_SEQUENTIAL range */
+#define READAHEAD_PAGES  8
+
+unsigned
+vm_faultaround(int npages)
+{
+	if (npages > VM_FAULTAROUND_MAX) {
+		npages = VM_FAULTAROUND_MAX;
+	}
+	if (npages >= 0) {
+		faultaround = npages;
+	}
+	return faultaround;
+}
+
+/*
+ * Fault-around: put the entries of up to WINDOW pages either side of
+ * VADDR that the refill handler could load as they are into this
+ * cpu's TLB now, so that a scan through resident pages doesn't miss
+ * on every one of them. Only entries with TLBLO_VALID qualify, which
+ * means they're in a segment and their frames are in; we look no
+ * further than VADDR's own second-level table. Pages the clock is
+ * watching (TLBLO_VALID clear) are left for their next real use.
+ * Called at splhigh with as_lock held.
+ */
+static
+void
+as_faultaround(struct addrspace *as, vaddr_t vaddr, unsigned window)
+{
+	uint32_t *l2;
+	vaddr_t base, va;
+	unsigned idx, lo, hi, j;
+	bool replace;
+	int i;
+
+	l2 = as->as_ptable[PT_L1(vaddr)];
+	KASSERT(l2 != NULL);
+	base = vaddr & ~(vaddr_t)(PT_SIZE * PAGE_SIZE - 1);
+	idx = PT_L2(vaddr);
+	lo = idx > window ? idx - window : 0;
+	hi = idx + window < PT_SIZE ? idx + window : PT_SIZE - 1;
+
+	for (j = lo; j <= hi; j++) {
+		if (j == idx || (l2[j] & TLBLO_VALID) == 0) {
+			continue;
+		}
+		va = base + j * PAGE_SIZE;
+		if (tlb_probe(as_tlbhi(as, va), 0) >= 0) {
+			continue;
+		}
+		i = tlb_getslot(&replace);
+		tlb_write(as_tlbhi(as, va), l2[j] & ~PTE_SOFT, i);
+		vmstats_inc(VMSTAT_TLB_PRELOAD);
+	}
+}
+
+/*
+ * Find which segment VADDR is in, and so whether there's a page there
+ * at all. *WRITEP says whether it may be written; for text and data
+ * pages *SRCP is where their initial contents come from, and for
+ * mapped files *MMP is the mapping. Any of them may be NULL. The
+ * stack is everything below USERSTACK down to its limit, short of
+ * the segments underneath.
+ */
+static
+bool
+as_lookup(struct addrspace *as, vaddr_t vaddr, bool *writep,
+	  struct segsource **srcp, struct mmapping **mmp)
+{
+	vaddr_t vtop1, vtop2, heaptop, floor;
+	struct segsource *src = NULL;
+	struct mmapping *mm = NULL;
+	bool writeable = true;
+
+	vtop1 = as->as_text_vbase + as->as_text_npages * PAGE_SIZE;
+	vtop2 = as->as_data_vbase + as->as_data_npages * PAGE_SIZE;
+	heaptop = ROUNDUP(as->as_heap_top, PAGE_SIZE);
+
+	floor = vtop1 > vtop2 ? vtop1 : vtop2;
+	if (floor < heaptop) {
+		floor = heaptop;
+	}
+	if (floor < USERSTACK - as->as_stack_limit * PAGE_SIZE) {
+		floor = USERSTACK - as->as_stack_limit * PAGE_SIZE;
+	}
+
+	if (vaddr >= as->as_text_vbase && vaddr < vtop1) {
+		src = &as->as_text_src;
+		writeable = as->as_text_writeable;
+	} else if (vaddr >= as->as_data_vbase && vaddr < vtop2) {
+		src = &as->as_data_src;
+		writeable = as->as_data_writeable;
+	} else if (vaddr >= as->as_heap_vbase && vaddr < heaptop) {
+		/* heap */
+	} else if (vaddr >= floor && vaddr < USERSTACK) {
+		/* stack */
+	} else {
+		for (mm = as->as_mmaps; mm != NULL; mm = mm->mm_next) {
+			if (vaddr >= mm->mm_vbase &&
+			    vaddr < mm->mm_vbase + mm->mm_npages * PAGE_SIZE) {
+				break;
+			}
+		}
+		if (mm == NULL) {
+			return false;
+		}
+		writeable = mm->mm_writeable;
+	}
+
+	if (writep != NULL) {
+		*writep = writeable;
+	}
+	if (srcp != NULL) {
+		*srcp = src;
+	}
+	if (mmp != NULL) {
+		*mmp = mm;
+	}
+	return true;
+}
+
+/*
+ * Bring the page at VPAGE back from the swap slot in its entry PTE.
+ */
+static
+int
+as_swap_in(struct addrspace *as, vaddr_t vpage, uint32_t *pte, bool fault)
+{
+	paddr_t paddr;
+	int result;
+
+	KASSERT(*pte & PTE_SWAPPED);
+
+	paddr = getuserpage(false);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	result = swap_in(PTE_SLOT(*pte), paddr);
+	if (result) {
+		coremap_decref(paddr);
+		return result;
+	}
+
+	// the frame keeps our reference to the slot until it's written,
+	// so that evicting it again costs nothing
+	coremap_setclean(paddr, PTE_SLOT(*pte));
+
+	vmstats_inc(fault ? VMSTAT_PAGE_FAULT_DISK : VMSTAT_PAGE_PREFETCH);
+	coremap_map(paddr, as, vpage);
+	*pte = paddr | PTE_RESIDENT | (*pte & PTE_KEEP);
+	return 0;
+}
+
+/*
+ * Push out page *PTE of AS, whose frame PADDR nobody can reach through
+ * the TLB any more: the clean ones and the read-only ones (which come
+ * back from the executable) are simply dropped, everything else goes
+ * to swap. If that fails, the page is left as it was.
+ */
+static
+int
+evict_page(struct addrspace *as, uint32_t *pte, paddr_t paddr,
+	   bool writeable)
+{
+	int slot, result;
+
+	if (writeable && coremap_getclean(paddr, &slot)) {
+		// never written: the copy it came from will do, and the
+		// slot, if any, passes to the entry
+		vmstats_inc(VMSTAT_CLEAN_EVICT);
+		if (slot >= 0) {
+			(void)coremap_setdirty(paddr);
+			*pte = PTE_MKSLOT(slot) | (*pte & PTE_KEEP);
+		} else {
+			*pte &= PTE_KEEP;
+		}
+	} else if (writeable) {
+		result = swap_out(paddr, &slot);
+		if (result) {
+			if ((*pte & PTE_NOREAD) == 0) {
+				*pte |= TLBLO_VALID;
+			}
+			return result;
+		}
+		*pte = PTE_MKSLOT(slot) | (*pte & PTE_KEEP);
+	} else {
+		*pte &= PTE_KEEP;
+	}
+	coremap_decref(paddr);
+	as->as_rss--;
+	return 0;
+}
+
+/*
+ * Local replacement: push out up to NPAGES of AS's own pages, chosen
+ * by a clock of its own (as_rss_hand) that goes round its page table,
+ * EVICT_BATCH at a time. Pages it has a frame of its own for go as
+ * vm_evict would send them; read-only pages go even if shared, since
+ * they come back from the file. Locked pages, mapped files and frames
+ * still shared copy-on-write stay. Returns how many went. Called with
+ * as_lock held.
+ */
+static
+unsigned
+as_trim(struct addrspace *as, unsigned npages)
+{
+	struct victim {
+		paddr_t v_paddr;
+		uint32_t *v_pte;
+		bool v_writeable;
+	} victims[EVICT_BATCH];
+	struct tlbshootdown ts[EVICT_BATCH];
+	struct addrspace *owner;
+	struct victim *v;
+	uint32_t *l2, *pte;
+	vaddr_t vaddr, ovaddr;
+	unsigned n, i, nscan, page, trimmed;
+	bool writeable, locked;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	// the evictor's own allocations don't get to push us around
+	if (evict_lock == NULL || lock_do_i_hold(evict_lock)) {
+		return 0;
+	}
+	lock_acquire(evict_lock);
+
+	trimmed = 0;
+	// two sweeps: the first may only be clearing reference bits
+	nscan = 2 * PT_SIZE * PT_SIZE;
+	while (trimmed < npages && nscan > 0) {
+		for (n = 0; n < EVICT_BATCH && trimmed + n < npages &&
+			     nscan > 0; nscan--) {
+			page = as->as_rss_hand;
+			as->as_rss_hand = (page + 1) % (PT_SIZE * PT_SIZE);
+			l2 = as->as_ptable[page / PT_SIZE];
+			if (l2 == NULL) {
+				// nothing in this 4M; on to the next
+				as->as_rss_hand = (page / PT_SIZE + 1) *
+					PT_SIZE % (PT_SIZE * PT_SIZE);
+				continue;
+			}
+			pte = &l2[page % PT_SIZE];
+			if ((*pte & PTE_RESIDENT) == 0 ||
+			    (*pte & (PTE_LOCKED | PTE_SHARED)) != 0) {
+				continue;
+			}
+			vaddr = (vaddr_t)page * PAGE_SIZE;
+			if (!as_lookup(as, vaddr, &writeable, NULL, NULL)) {
+				continue;
+			}
+			locked = false;
+			if (writeable &&
+			    (!coremap_lockmapping(PTE_PADDR(*pte), &owner,
+						  &ovaddr, &locked) ||
+			     owner != as || ovaddr != vaddr)) {
+				// shared since fork; not ours to write out
+				if (locked) {
+					lock_release(owner->as_lock);
+				}
+				continue;
+			}
+			if (coremap_testref(PTE_PADDR(*pte))) {
+				// second chance, as in coremap_victim
+				as_unreference(as, vaddr);
+				continue;
+			}
+
+			v = &victims[n];
+			v->v_paddr = PTE_PADDR(*pte);
+			v->v_pte = pte;
+			v->v_writeable = writeable;
+			*pte &= ~TLBLO_VALID;
+			ts[n].ts_addrspace = as;
+			ts[n].ts_vaddr = vaddr;
+			n++;
+		}
+		if (n == 0) {
+			break;
+		}
+
+		vm_shootdown(ts, n);
+
+		for (i = 0; i < n; i++) {
+			v = &victims[i];
+			if (evict_page(as, v->v_pte, v->v_paddr,
+				       v->v_writeable) == 0) {
+				trimmed++;
+			}
+		}
+	}
+
+	lock_release(evict_lock);
+	as->as_ntrimmed += trimmed;
+	return trimmed;
+}
+
+/*
+ * Give the page at VPAGE, which isn't resident, a frame: from the page
+ * cache if it's in mapped file MM, from swap if it was pushed out
+ * there, and otherwise as on first touch (as_load_page, which SRC,
+ * WRITEABLE and FAULT are for). If that would take AS over its
+ * resident set limit, one of its own pages makes room first.
+ */
+static
+int
+as_page_in(struct addrspace *as, vaddr_t vpage, uint32_t *pte,
+	   bool writeable, struct segsource *src, struct mmapping *mm,
+	   bool fault)
+{
+	paddr_t paddr;
+	bool read;
+	int result;
+
+	KASSERT((*pte & PTE_RESIDENT) == 0);
+
+	if (as->as_rss_limit != 0 && as->as_rss >= as->as_rss_limit) {
+		// if nothing can go, we go over; better than failing
+		(void)as_trim(as, as->as_rss - as->as_rss_limit + 1);
+	}
+
+	if (mm != NULL) {
+		result = pagecache_get(mm->mm_vnode,
+				       mm->mm_offset + (vpage - mm->mm_vbase),
+				       &paddr, &read);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_RESIDENT | PTE_SHARED | (*pte & PTE_KEEP);
+		// somebody else's fault may have brought it in already
+		if (read) {
+			vmstats_inc(fault ? VMSTAT_PAGE_FAULT_DISK :
+				    VMSTAT_PAGE_PREFETCH);
+			vmstats_inc(VMSTAT_MMAP_FILE_READ);
+		} else if (fault) {
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+		}
+	} else if (*pte & PTE_SWAPPED) {
+		result = as_swap_in(as, vpage, pte, fault);
+	} else {
+		result = as_load_page(as, src, vpage, writeable, pte, fault);
+	}
+	if (result == 0) {
+		as->as_rss++;
+		if (fault) {
+			as->as_npageins++;
+		}
+	}
+	return result;
+}
+
+/*
+ * Let the refill handler load resident page *PTE as after a read
+ * fault: read-only, so that the first write goes through vm_fault.
+ */
+static
+void
+pte_ready(uint32_t *pte)
+{
+	*pte &= ~TLBLO_DIRTY;
+	if ((*pte & PTE_NOREAD) == 0) {
+		*pte |= TLBLO_VALID;
+	}
+}
+
+/*
+ * Bring in up to NPAGES pages from VADDR up that aren't resident, as
+ * if they'd been read, ready for the refill handler. Pages with
+ * nothing to read are left to be zero-filled on first touch. With SEQ
+ * this is read-ahead, and stops at the first page not marked
+ * PTE_SEQ. It's only ever a hint, so it quietly stops at the first
+ * failure too. Called with as_lock held.
+ */
+static
+void
+as_prefetch(struct addrspace *as, vaddr_t vaddr, unsigned npages, bool seq)
+{
+	struct segsource *src;
+	struct mmapping *mm;
+	uint32_t *pte;
+	vaddr_t va;
+	bool writeable;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (n = 0, va = vaddr; n < npages; n++, va += PAGE_SIZE) {
+		if (!as_lookup(as, va, &writeable, &src, &mm)) {
+			if (seq) {
+				break;
+			}
+			continue;
+		}
+		pte = as_pte(as, va, !seq);
+		if (pte == NULL || (seq && (*pte & PTE_SEQ) == 0)) {
+			break;
+		}
+		if (*pte & PTE_RESIDENT) {
+			continue;
+		}
+		if (mm == NULL && (*pte & PTE_SWAPPED) == 0 &&
+		    (src == NULL || va + PAGE_SIZE <= src->ss_vaddr ||
+		     va >= src->ss_vaddr + src->ss_filesz)) {
+			continue;
+		}
+		// read-ahead isn't worth pushing our own pages out for
+		if (as->as_rss_limit != 0 && as->as_rss >= as->as_rss_limit) {
+			break;
+		}
+		if (as_page_in(as, va, pte, writeable, src, mm, false)) {
+			break;
+		}
+		pte_ready(pte);
+	}
+}
+
+/*
+ * Push user pages out of memory to make room, up to EVICT_BATCH at a
+ * time so that they can share one round of shootdowns. The clock in
+ * the coremap picks the frames. Read-only pages are simply dropped,
+ * since they come back from the executable; everything else goes to
+ * swap. Succeeds if at least one frame was freed.
+ */
+static
+int
+vm_evict(void)
+{
+	struct victim {
+		paddr_t v_paddr;
+		uint32_t *v_pte;
+		bool v_locked;
+		bool v_writeable;
+	} victims[EVICT_BATCH];
+	struct tlbshootdown ts[EVICT_BATCH];
+	struct addrspace *as;
+	struct victim *v;
+	vaddr_t vaddr;
+	unsigned n, i;
+	int result;
+
+	// not set up yet, or we're already evicting and the disk
+	// driver wants memory
+	if (evict_lock == NULL || lock_do_i_hold(evict_lock)) {
+		return ENOMEM;
+	}
+
+	// file pages nobody has mapped are the cheapest to get back
+	if (pagecache_evict() == 0) {
+		return 0;
+	}
+
+	lock_acquire(evict_lock);
+
+	for (n = 0; n < EVICT_BATCH; n++) {
+		v = &victims[n];
+		v->v_paddr = coremap_victim(&as, &vaddr, &v->v_locked);
+		if (v->v_paddr == 0) {
+			break;
+		}
+
+		// never a mapped file page; those aren't ours to evict
+		v->v_pte = as_pte(as, vaddr, false);
+		KASSERT(v->v_pte != NULL);
+		KASSERT((*v->v_pte & PTE_RESIDENT) &&
+			PTE_PADDR(*v->v_pte) == v->v_paddr);
+		if (!as_lookup(as, vaddr, &v->v_writeable, NULL, NULL)) {
+			panic("vm_evict: frame 0x%x maps nothing\n",
+			      v->v_paddr);
+		}
+
+		// nobody may touch the frame through a stale TLB entry
+		// while we copy it out, and the refill handler mustn't
+		// make new ones
+		*v->v_pte &= ~TLBLO_VALID;
+		ts[n].ts_addrspace = as;
+		ts[n].ts_vaddr = vaddr;
+	}
+	if (n == 0) {
+		lock_release(evict_lock);
+		return ENOMEM;
+	}
+
+	vm_shootdown(ts, n);
+
+	result = ENOMEM;
+	for (i = 0; i < n; i++) {
+		v = &victims[i];
+		if (evict_page(ts[i].ts_addrspace, v->v_pte, v->v_paddr,
+			       v->v_writeable) != 0) {
+			coremap_unbusy(v->v_paddr);
+			continue;
+		}
+		result = 0;
+	}
+
+	// only now: later victims may have shared an address space
+	for (i = 0; i < n; i++) {
+		if (victims[i].v_locked) {
+			lock_release(ts[i].ts_addrspace->as_lock);
+		}
+	}
+	lock_release(evict_lock);
+	return result;
+}
+
+bool
+vm_unmapfile(struct vnode *vn, off_t offset, paddr_t paddr, bool unmap)
+{
+	struct filemap {
+		uint32_t *f_pte;
+		uint32_t f_old;
+		bool f_locked;
+	} maps[EVICT_BATCH];
+	struct tlbshootdown ts[EVICT_BATCH];
+	struct addrspace *as;
+	struct mmapping *mm;
+	uint32_t *pte;
+	vaddr_t va;
+	unsigned n, i;
+	bool locked, kept, ok;
+
+	// shootdowns need evict_lock; the list must hold still
+	if (unmap && !lock_tryacquire(evict_lock)) {
+		return false;
+	}
+	if (!lock_tryacquire(aslist_lock)) {
+		if (unmap) {
+			lock_release(evict_lock);
+		}
+		return false;
+	}
+
+	n = 0;
+	ok = true;
+	for (as = as_all; as != NULL && ok; as = as->as_next) {
+		locked = false;
+		if (!lock_do_i_hold(as->as_lock)) {
+			if (!lock_tryacquire(as->as_lock)) {
+				ok = false;
+				break;
+			}
+			locked = true;
+		}
+
+		// the same page may be mapped more than once
+		kept = false;
+		for (mm = as->as_mmaps; mm != NULL; mm = mm->mm_next) {
+			if (mm->mm_vnode != vn || offset < mm->mm_offset ||
+			    offset >= mm->mm_offset +
+			    (off_t)mm->mm_npages * PAGE_SIZE) {
+				continue;
+			}
+			va = mm->mm_vbase + (offset - mm->mm_offset);
+			pte = as_pte(as, va, false);
+			if (pte == NULL || (*pte & PTE_RESIDENT) == 0 ||
+			    PTE_PADDR(*pte) != paddr) {
+				continue;
+			}
+			if (!unmap) {
+				as_unreference(as, va);
+				continue;
+			}
+			if ((*pte & PTE_LOCKED) || n == EVICT_BATCH) {
+				ok = false;
+				break;
+			}
+
+			// as in vm_evict: no new TLB entries from here on
+			maps[n].f_pte = pte;
+			maps[n].f_old = *pte;
+			maps[n].f_locked = locked && !kept;
+			*pte &= ~TLBLO_VALID;
+			ts[n].ts_addrspace = as;
+			ts[n].ts_vaddr = va;
+			kept = true;
+			n++;
+		}
+		if (locked && !kept) {
+			lock_release(as->as_lock);
+		}
+	}
+	lock_release(aslist_lock);
+
+	if (ok && n > 0) {
+		vm_shootdown(ts, n);
+	}
+	for (i = 0; i < n; i++) {
+		if (!ok) {
+			*maps[i].f_pte = maps[i].f_old;
+			continue;
+		}
+		// the next use gets the page from the cache again
+		*maps[i].f_pte &= PTE_KEEP;
+		coremap_decref(paddr);
+		ts[i].ts_addrspace->as_rss--;
+	}
+	for (i = 0; i < n; i++) {
+		if (maps[i].f_locked) {
+			lock_release(ts[i].ts_addrspace->as_lock);
+		}
+	}
+	if (unmap) {
+		lock_release(evict_lock);
+	}
+	return ok;
+}
+
+/*
+ * Open up a block of NPAGES contiguous frames for the kernel by moving
+ * the user pages in the way to frames elsewhere, EVICT_BATCH at a time
+ * so that they can share one round of shootdowns. Only pages with a
+ * frame of their own and a recorded mapping can be moved; the coremap
+ * picks a block with nothing else in it. Returns the block, or 0.
+ */
+static
+paddr_t
+vm_compact(unsigned long npages)
+{
+	struct migrant {
+		paddr_t m_paddr;
+		uint32_t *m_pte;
+		bool m_locked;
+		uint32_t m_valid;
+	} migrants[EVICT_BATCH];
+	struct tlbshootdown ts[EVICT_BATCH];
+	struct addrspace *as;
+	struct migrant *m;
+	paddr_t base, paddr;
+	vaddr_t vaddr;
+	unsigned nframes, next, n, i, moved;
+	int slot;
+	bool ok;
+
+	// as in vm_evict: shootdowns need evict_lock
+	if (evict_lock == NULL || lock_do_i_hold(evict_lock)) {
+		return 0;
+	}
+	lock_acquire(evict_lock);
+
+	base = coremap_compact_begin(npages);
+	if (base == 0) {
+		lock_release(evict_lock);
+		return 0;
+	}
+
+	for (nframes = 1; nframes < npages; nframes *= 2);
+	moved = 0;
+	ok = true;
+	next = 0;
+	while (ok && next < nframes) {
+		// pages freed or vacated since are simply passed over; any
+		// that can't be moved after all spoil it at the end
+		for (n = 0; n < EVICT_BATCH && next < nframes; next++) {
+			m = &migrants[n];
+			m->m_paddr = base + next * PAGE_SIZE;
+			if (!coremap_lockmapping(m->m_paddr, &as, &vaddr,
+						 &m->m_locked)) {
+				continue;
+			}
+			m->m_pte = as_pte(as, vaddr, false);
+			KASSERT(m->m_pte != NULL);
+			KASSERT((*m->m_pte & PTE_RESIDENT) &&
+				PTE_PADDR(*m->m_pte) == m->m_paddr);
+
+			// nobody may write the old frame while we copy it
+			m->m_valid = *m->m_pte & TLBLO_VALID;
+			*m->m_pte &= ~TLBLO_VALID;
+			ts[n].ts_addrspace = as;
+			ts[n].ts_vaddr = vaddr;
+			n++;
+		}
+		if (n == 0) {
+			continue;
+		}
+
+		vm_shootdown(ts, n);
+
+		for (i = 0; i < n; i++) {
+			m = &migrants[i];
+			// from elsewhere: the block's free frames are ours
+			paddr = ok ? coremap_alloc(1, CM_USER) : 0;
+			if (paddr == 0) {
+				*m->m_pte |= m->m_valid;
+				ok = false;
+				continue;
+			}
+			memcpy((void *)PADDR_TO_KVADDR(paddr),
+			       (void *)PADDR_TO_KVADDR(m->m_paddr), PAGE_SIZE);
+
+			// a clean frame's slot goes with its contents
+			if (coremap_getclean(m->m_paddr, &slot)) {
+				(void)coremap_setdirty(m->m_paddr);
+				coremap_setclean(paddr, slot);
+			}
+			coremap_map(paddr, ts[i].ts_addrspace, ts[i].ts_vaddr);
+			*m->m_pte = paddr | (*m->m_pte & ~PAGE_FRAME) |
+				m->m_valid;
+			coremap_isolate(m->m_paddr);
+			moved++;
+		}
+
+		// only now: pages in a batch may share an address space
+		for (i = 0; i < n; i++) {
+			if (migrants[i].m_locked) {
+				lock_release(ts[i].ts_addrspace->as_lock);
+			}
+		}
+	}
+
+	base = coremap_compact_end(base, npages, CM_KERNEL);
+	lock_release(evict_lock);
+
+	vmstats_inc(base != 0 ? VMSTAT_COMPACT : VMSTAT_COMPACT_FAIL);
+	vmstats_add(VMSTAT_PAGE_MIGRATE, moved);
+	return base;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct tlbbatch tb;
+	struct segsource *src;
+	struct mmapping *mm;
+	uint32_t *pte;
+	paddr_t paddr;
+	off_t offset;
+	bool writeable, canwrite, replace, readahead;
+	uint32_t ehi, elo;
+	int i, spl, result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		// copy-on-write, or a real write to a read-only page;
+		// sorted out once we know the segment
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	tlbbatch_init(&tb, as);
+
+	// keeps the evictor away from our page tables until we're done
+	lock_acquire(as->as_lock);
+
+	if (!as_lookup(as, faultaddress, &writeable, &src, &mm)) {
+		result = EFAULT;
+		goto done;
+	}
+	pte = as_pte(as, faultaddress, true);
+	if (pte == NULL) {
+		result = ENOMEM;
+		goto done;
+	}
+	if (*pte & PTE_NOREAD) {
+		// a guard page, or one a collector is watching
+		result = EFAULT;
+		goto done;
+	}
+	// the segment still decides how the page is loaded and evicted
+	canwrite = writeable && (*pte & PTE_NOWRITE) == 0;
+
+	offset = 0;
+	if (mm != NULL) {
+		offset = mm->mm_offset + (faultaddress - mm->mm_vbase);
+	}
+
+	if (faulttype == VM_FAULT_READONLY) {
+		if (!canwrite) {
+			// kill the current process, don't panic
+			result = EINVAL;
+			goto done;
+		}
+		if ((*pte & PTE_RESIDENT) == 0) {
+			// evicted since the fault; try again from scratch
+			result = 0;
+			goto done;
+		}
+		if (mm != NULL) {
+			// mapped file pages start out read-only so that
+			// we hear about the first write
+			pagecache_dirty(mm->mm_vnode, offset,
+					PTE_PADDR(*pte));
+		} else if (*pte & PTE_COW) {
+			// the TLB already maps the shared frame read-only;
+			// point that entry at our own copy
+			result = as_break_cow(as, faultaddress, pte, &tb);
+			if (result) {
+				goto done;
+			}
+		}
+		pte_dirty(pte);
+		*pte |= TLBLO_VALID;
+		spl = splhigh();
+		i = tlb_probe(as_tlbhi(as, faultaddress), 0);
+		if (i >= 0) {
+			tlb_write(as_tlbhi(as, faultaddress),
+				  *pte & ~PTE_SOFT, i);
+		}
+		splx(spl);
+		goto done;
+	}
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	as->as_nfaults++;
+
+	readahead = false;
+	if (*pte & PTE_RESIDENT) {
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		paddr = PTE_PADDR(*pte);
+		if ((*pte & PTE_COW) && coremap_refcount(paddr) == 1) {
+			// everyone we shared with is gone; it's ours again
+			*pte &= ~PTE_COW;
+			as_mapframe(as, faultaddress, pte);
+		} else {
+			coremap_reference(paddr);
+		}
+	} else {
+		result = as_page_in(as, faultaddress, pte, writeable, src, mm,
+				    true);
+		if (result) {
+			goto done;
+		}
+		readahead = (*pte & PTE_SEQ) != 0;
+	}
+
+	if (faulttype == VM_FAULT_WRITE && canwrite && (*pte & PTE_COW)) {
+		// write is coming anyway; skip the read-only round trip
+		result = as_break_cow(as, faultaddress, pte, &tb);
+		if (result) {
+			goto done;
+		}
+	}
+	if (faulttype == VM_FAULT_WRITE && canwrite && mm != NULL) {
+		pagecache_dirty(mm->mm_vnode, offset, PTE_PADDR(*pte));
+	}
+
+	// everything stays read-only in the TLB until it's written,
+	// so that only pages that were can cost a write on the way
+	// out; a frame still shared with another address space stays
+	// read-only even then
+	*pte &= ~TLBLO_DIRTY;
+	if (canwrite && (*pte & PTE_COW) == 0 &&
+	    faulttype == VM_FAULT_WRITE) {
+		pte_dirty(pte);
+	}
+	// next time, mips_utlb_handler can do this without us
+	*pte |= TLBLO_VALID;
+
+	ehi = as_tlbhi(as, faultaddress);
+	elo = *pte & ~PTE_SOFT;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	// if we slept and came back on another cpu, this one may still
+	// have the page from earlier; two matching entries would be fatal
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		replace = true;
+	} else {
+		i = tlb_getslot(&replace);
+	}
+	vmstats_inc(replace ? VMSTAT_TLB_FAULT_REPLACE : VMSTAT_TLB_FAULT_FREE);
+	tlb_write(ehi, elo, i);
+	if (faultaround > 0) {
+		as_faultaround(as, faultaddress, faultaround);
+	}
+	splx(spl);
+
+	// only once the TLB has the page: reading ahead may evict it
+	// again, and then the entry has to be shot down like any other
+	if (readahead) {
+		as_prefetch(as, faultaddress + PAGE_SIZE, READAHEAD_PAGES,
+			    true);
+	}
+	result = 0;
+
+ done:
+	lock_release(as->as_lock);
+	// other TLBs may still have the frame we copied
+	tlbbatch_flush(&tb);
+	return result;
+}
+#else
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	paddr_t paddr;
+	int i;
+	uint32_t ehi, elo;
+	struct addrspace *as;
+	int spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/* We always create pages read-write, so we can't get this */
+		panic("dumbvm: got VM_FAULT_READONLY\n");
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	/* Assert that the address space has been set up properly. */
+	KASSERT(as->as_vbase1 != 0);
+	KASSERT(as->as_pbase1 != 0);
+	KASSERT(as->as_npages1 != 0);
+	KASSERT(as->as_vbase2 != 0);
+	KASSERT(as->as_pbase2 != 0);
+	KASSERT(as->as_npages2 != 0);
+	KASSERT(as->as_stackpbase != 0);
+	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
+	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
+	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
@@ -332,40 +1807,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-#endif
-
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_read(&ehi, &elo, i);
-#if OPT_A3
-		bool full = false;
-		if (elo & TLBLO_VALID && i == NUM_TLB - 1) {
-			// reached end of TLB, we know it is full
-			full = true;
-		} else if (elo & TLBLO_VALID) {
-			// not at end of TLB but current slot is occupied
-			continue;
-		}
-		ehi = faultaddress;
-		if (readOnly && as->as_loaded) {
-			// addrspace is done loading and we're in read-only space
-			elo = (paddr | TLBLO_VALID) & ~TLBLO_DIRTY;
-		} else {
-			// addrspace not done loading or we're in writable space
-			elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		}
-		if (full) {
-			// kick something random out
-			tlb_random(ehi, elo);
-		} else {
-			tlb_write(ehi, elo, i);
-		}
-		splx(spl);
-		return 0;
-	}
-#else
 		if (elo & TLBLO_VALID) {
 			continue;
 		}
@@ -376,11 +1822,385 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		splx(spl);
 		return 0;
 	}
-#endif
 	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
 	splx(spl);
 	return EFAULT;
 }
+#endif
+
+#if OPT_A3
+/*
+ * Same-page merging. A kernel thread walks the coremap a few pages a
+ * second, hashing the private user frames it finds, and folds
+ * byte-identical ones into one frame that all their pages share
+ * copy-on-write, just as after fork.
+ *
+ * Merged frames go in the stable table, which holds a reference to
+ * each. That way a merged frame is never written - whoever writes,
+ * even its last user, gets a copy (as_break_cow) - and its entry
+ * stays good. At the end of each pass the ones nobody else uses any
+ * more are let go. Frames seen once so far go in the unstable table,
+ * which starts over every pass; those are recorded by address only
+ * and looked up in the coremap again before they're used.
+ *
+ * The tables are allocated at boot: the merger works with address
+ * spaces locked, so it mustn't end up in the evictor.
+ */
+#define MERGE_MAX        256	/* entries in each table */
+#define MERGE_NBUCKETS   64
+#define MERGE_RATE_DEFAULT  64	/* pages a second */
+
+struct mergepage {
+	uint32_t mp_hash;
+	paddr_t mp_paddr;
+	struct mergepage *mp_next;	/* same bucket, or free */
+};
+
+struct mergetable {
+	struct mergepage *mt_buckets[MERGE_NBUCKETS];
+	struct mergepage *mt_free;
+	unsigned mt_count;
+};
+
+static struct lock *merge_lock;		/* the tables */
+static struct mergetable merge_stable, merge_unstable;
+static unsigned merge_rate = MERGE_RATE_DEFAULT;
+
+static
+void
+mt_init(struct mergetable *mt)
+{
+	struct mergepage *mp;
+	unsigned i;
+
+	mp = kmalloc(MERGE_MAX * sizeof(struct mergepage));
+	if (mp == NULL) {
+		panic("vm_merge_bootstrap: out of memory\n");
+	}
+	mt->mt_free = NULL;
+	for (i = 0; i < MERGE_MAX; i++) {
+		mp[i].mp_next = mt->mt_free;
+		mt->mt_free = &mp[i];
+	}
+	for (i = 0; i < MERGE_NBUCKETS; i++) {
+		mt->mt_buckets[i] = NULL;
+	}
+	mt->mt_count = 0;
+}
+
+/* Record frame PADDR with contents hashing to HASH, if there's room. */
+static
+void
+mt_insert(struct mergetable *mt, uint32_t hash, paddr_t paddr)
+{
+	struct mergepage *mp;
+
+	mp = mt->mt_free;
+	if (mp == NULL) {
+		return;
+	}
+	mt->mt_free = mp->mp_next;
+	mp->mp_hash = hash;
+	mp->mp_paddr = paddr;
+	mp->mp_next = mt->mt_buckets[hash % MERGE_NBUCKETS];
+	mt->mt_buckets[hash % MERGE_NBUCKETS] = mp;
+	mt->mt_count++;
+}
+
+/* Take the entry *MPP points to out of its bucket. */
+static
+void
+mt_remove(struct mergetable *mt, struct mergepage **mpp)
+{
+	struct mergepage *mp = *mpp;
+
+	*mpp = mp->mp_next;
+	mp->mp_next = mt->mt_free;
+	mt->mt_free = mp;
+	mt->mt_count--;
+}
+
+/* FNV-1a, a word at a time. */
+static
+uint32_t
+merge_hash(paddr_t paddr)
+{
+	const uint32_t *p = (const uint32_t *)PADDR_TO_KVADDR(paddr);
+	uint32_t hash = 2166136261U;
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		hash = (hash ^ p[i]) * 16777619U;
+	}
+	return hash;
+}
+
+/* Whether frames A and B hold the same bytes; there's no memcmp. */
+static
+bool
+merge_same(paddr_t a, paddr_t b)
+{
+	const uint32_t *pa = (const uint32_t *)PADDR_TO_KVADDR(a);
+	const uint32_t *pb = (const uint32_t *)PADDR_TO_KVADDR(b);
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (pa[i] != pb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Keep the N pages in TS, whose entries have just had TLBLO_VALID
+ * cleared, from changing under us while we compare them: once no TLB
+ * has them, a write has to go through vm_fault, and that waits for
+ * the as_locks we hold.
+ */
+static
+void
+merge_freeze(struct tlbshootdown *ts, unsigned n)
+{
+	lock_acquire(evict_lock);
+	vm_shootdown(ts, n);
+	lock_release(evict_lock);
+}
+
+/* Point page *PTE at merged frame KPADDR instead of its own. */
+static
+void
+merge_into(uint32_t *pte, paddr_t kpaddr)
+{
+	paddr_t old = PTE_PADDR(*pte);
+
+	coremap_incref(kpaddr);
+	*pte = kpaddr | PTE_RESIDENT | PTE_COW | (*pte & PTE_KEEP);
+	pte_ready(pte);
+	frame_release(old);
+	vmstats_inc(VMSTAT_PAGE_MERGE);
+}
+
+/*
+ * Look for another frame just like PADDR, which holds page VADDR of
+ * AS, and merge them if there is one. Called with AS's as_lock.
+ */
+static
+void
+merge_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	struct tlbshootdown ts[2];
+	struct mergepage *mp, **mpp;
+	struct addrspace *as2;
+	vaddr_t vaddr2;
+	uint32_t *pte, *pte2, valid, valid2, hash;
+	bool locked2;
+	int slot;
+
+	pte = as_pte(as, vaddr, false);
+	KASSERT(pte != NULL && (*pte & PTE_RESIDENT) &&
+		PTE_PADDR(*pte) == paddr);
+	hash = merge_hash(paddr);
+	ts[0].ts_addrspace = as;
+	ts[0].ts_vaddr = vaddr;
+
+	// a frame already merged?
+	for (mp = merge_stable.mt_buckets[hash % MERGE_NBUCKETS];
+	     mp != NULL; mp = mp->mp_next) {
+		if (mp->mp_hash == hash) {
+			break;
+		}
+	}
+	if (mp != NULL) {
+		valid = *pte & TLBLO_VALID;
+		*pte &= ~TLBLO_VALID;
+		merge_freeze(ts, 1);
+		for (; mp != NULL; mp = mp->mp_next) {
+			if (mp->mp_hash == hash &&
+			    merge_same(mp->mp_paddr, paddr)) {
+				merge_into(pte, mp->mp_paddr);
+				return;
+			}
+		}
+		*pte |= valid;
+		return;
+	}
+
+	// or one seen before on this pass?
+	mpp = &merge_unstable.mt_buckets[hash % MERGE_NBUCKETS];
+	while (*mpp != NULL) {
+		mp = *mpp;
+		if (mp->mp_hash != hash || mp->mp_paddr == paddr) {
+			mpp = &mp->mp_next;
+			continue;
+		}
+		if (!coremap_lockmapping(mp->mp_paddr, &as2, &vaddr2,
+					 &locked2)) {
+			// gone, or busy; either way not now
+			mt_remove(&merge_unstable, mpp);
+			continue;
+		}
+		if (merge_stable.mt_free == NULL) {
+			if (locked2) {
+				lock_release(as2->as_lock);
+			}
+			return;
+		}
+		pte2 = as_pte(as2, vaddr2, false);
+		KASSERT(pte2 != NULL && (*pte2 & PTE_RESIDENT) &&
+			PTE_PADDR(*pte2) == mp->mp_paddr);
+
+		valid = *pte & TLBLO_VALID;
+		valid2 = *pte2 & TLBLO_VALID;
+		*pte &= ~TLBLO_VALID;
+		*pte2 &= ~TLBLO_VALID;
+		ts[1].ts_addrspace = as2;
+		ts[1].ts_vaddr = vaddr2;
+		merge_freeze(ts, 2);
+
+		if (merge_same(mp->mp_paddr, paddr)) {
+			// the other one becomes the merged frame; it's
+			// shared from now on, so it can't keep a slot
+			slot = coremap_setdirty(mp->mp_paddr);
+			if (slot >= 0) {
+				swap_decref(slot);
+			}
+			coremap_incref(mp->mp_paddr);
+			*pte2 = mp->mp_paddr | PTE_RESIDENT | PTE_COW |
+				(*pte2 & PTE_KEEP);
+			pte_ready(pte2);
+			merge_into(pte, mp->mp_paddr);
+			vmstats_inc(VMSTAT_PAGE_MERGE);
+
+			mt_insert(&merge_stable, hash, mp->mp_paddr);
+			mt_remove(&merge_unstable, mpp);
+		} else {
+			*pte |= valid;
+			*pte2 |= valid2;
+		}
+		if (locked2) {
+			lock_release(as2->as_lock);
+		}
+		return;
+	}
+
+	mt_insert(&merge_unstable, hash, paddr);
+}
+
+/*
+ * End of a pass over memory: forget the unstable table, and let go of
+ * merged frames nobody else has any more.
+ */
+static
+void
+merge_endpass(void)
+{
+	struct mergepage **mpp;
+	paddr_t paddr;
+	unsigned i;
+
+	for (i = 0; i < MERGE_NBUCKETS; i++) {
+		while (merge_unstable.mt_buckets[i] != NULL) {
+			mt_remove(&merge_unstable,
+				  &merge_unstable.mt_buckets[i]);
+		}
+
+		mpp = &merge_stable.mt_buckets[i];
+		while (*mpp != NULL) {
+			paddr = (*mpp)->mp_paddr;
+			// only we can get at it to take a new reference
+			if (coremap_refcount(paddr) > 1) {
+				mpp = &(*mpp)->mp_next;
+				continue;
+			}
+			mt_remove(&merge_stable, mpp);
+			frame_release(paddr);
+		}
+	}
+}
+
+static
+void
+merge_thread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *as;
+	unsigned cursor = 0, n;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	bool locked;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+		for (n = 0; n < merge_rate; n++) {
+			lock_acquire(merge_lock);
+			paddr = coremap_scan(&cursor, &as, &vaddr, &locked);
+			if (paddr == 0) {
+				merge_endpass();
+				lock_release(merge_lock);
+				break;
+			}
+			merge_page(as, vaddr, paddr);
+			if (locked) {
+				lock_release(as->as_lock);
+			}
+			lock_release(merge_lock);
+		}
+	}
+}
+
+static
+void
+vm_merge_bootstrap(void)
+{
+	int result;
+
+	merge_lock = lock_create("merge");
+	if (merge_lock == NULL) {
+		panic("vm_merge_bootstrap: out of memory\n");
+	}
+	mt_init(&merge_stable);
+	mt_init(&merge_unstable);
+
+	result = thread_fork("vm_merge", NULL, merge_thread, NULL, 0);
+	if (result) {
+		panic("vm_merge_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+unsigned
+vm_mergerate(int npages)
+{
+	if (npages >= 0) {
+		merge_rate = npages;
+	}
+	return merge_rate;
+}
+
+void
+vm_mergestats(void)
+{
+	struct mergepage *mp;
+	unsigned i, shared = 0, sharing = 0;
+
+	lock_acquire(merge_lock);
+	for (i = 0; i < MERGE_NBUCKETS; i++) {
+		for (mp = merge_stable.mt_buckets[i]; mp != NULL;
+		     mp = mp->mp_next) {
+			shared++;
+			sharing += coremap_refcount(mp->mp_paddr) - 1;
+		}
+	}
+	lock_release(merge_lock);
+
+	kprintf("Same-page merging: %u pages a second\n", merge_rate);
+	kprintf("%u frames shared by %u pages, %u frames saved\n",
+		shared, sharing, sharing > shared ? sharing - shared : 0);
+}
+#endif
 
 struct addrspace *
 as_create(void)
@@ -392,13 +2212,46 @@ as_create(void)
 
 #if OPT_A3
 	as->as_text_vbase = 0;
-	// as->as_text_ptable;
 	as->as_text_npages = 0;
+	as->as_text_writeable = false;
 	as->as_data_vbase = 0;
-	// as->as_data_ptable;
 	as->as_data_npages = 0;
-	//as->as_stack_ptable = kmalloc(DUMBVM_STACKPAGES * sizeof(struct pagetable));
+	as->as_data_writeable = false;
+	as->as_stack_limit = as_stacklimit(0);
+	as->as_heap_vbase = 0;
+	as->as_heap_top = 0;
+	as->as_mmaps = NULL;
 	as->as_loaded = false;
+	as->as_vnode = NULL;
+	bzero(&as->as_text_src, sizeof(struct segsource));
+	bzero(&as->as_data_src, sizeof(struct segsource));
+	as->as_ptable = pt_getpage();
+	if (as->as_ptable == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		free_kpages((vaddr_t)as->as_ptable);
+		kfree(as);
+		return NULL;
+	}
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_cpus = 0;
+	as->as_nlocked = 0;
+	as->as_rss = 0;
+	as->as_rss_limit = as_rssdefault(-1);
+	as->as_rss_hand = 0;
+	as->as_nfaults = 0;
+	as->as_npageins = 0;
+	as->as_ntrimmed = 0;
+	as->as_pid = 0;
+
+	lock_acquire(aslist_lock);
+	as->as_next = as_all;
+	as_all = as;
+	lock_release(aslist_lock);
 #else
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
@@ -412,251 +2265,1029 @@ as_create(void)
 	return as;
 }
 
+#if OPT_A3
+/*
+ * Drop every frame and swap slot in AS's page table, and the table.
+ */
+static
+void
+as_free_ptable(struct addrspace *as)
+{
+	uint32_t *l2;
+	unsigned i, j;
+
+	for (i = 0; i < PT_SIZE; i++) {
+		l2 = as->as_ptable[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_SIZE; j++) {
+			pte_release(as, &l2[j]);
+		}
+		free_kpages((vaddr_t)l2);
+	}
+	free_kpages((vaddr_t)as->as_ptable);
+	as->as_ptable = NULL;
+}
+
+/*
+ * Drop mapping MM's pages, writing the dirty ones back, and the
+ * mapping itself. The caller has unlinked it; pages that were in
+ * memory are added to TB, if there is one, for the caller to flush.
+ * Returns the first writeback error, but frees everything regardless.
+ */
+static
+int
+as_free_mmapping(struct addrspace *as, struct mmapping *mm,
+		 struct tlbbatch *tb)
+{
+	uint32_t *pte;
+	size_t i;
+	int result, ret = 0;
+
+	for (i = 0; i < mm->mm_npages; i++) {
+		pte = as_pte(as, mm->mm_vbase + i * PAGE_SIZE, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_LOCKED) {
+			as->as_nlocked--;
+		}
+		if ((*pte & PTE_RESIDENT) == 0) {
+			// madvise may have left its mark
+			*pte = 0;
+			continue;
+		}
+		KASSERT(*pte & PTE_SHARED);
+		if (tb != NULL) {
+			tlbbatch_add(tb, mm->mm_vbase + i * PAGE_SIZE);
+		}
+		result = pagecache_put(mm->mm_vnode,
+				       mm->mm_offset + i * PAGE_SIZE,
+				       PTE_PADDR(*pte));
+		*pte = 0;
+		as->as_rss--;
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+	vfs_close(mm->mm_vnode);
+	kfree(mm);
+	return ret;
+}
+#endif
+
 void
 as_destroy(struct addrspace *as)
 {
 #if OPT_A3
-	// call free_kpages on the frames for each seg
-	for (int i = 0; i < (int)as->as_text_npages; i++) {
-		free_kpages(as->as_text_ptable[i].paddr);
+	struct addrspace **asp;
+	struct mmapping *mm;
+
+	lock_acquire(aslist_lock);
+	for (asp = &as_all; *asp != as; asp = &(*asp)->as_next) {
+		KASSERT(*asp != NULL);
+	}
+	*asp = as->as_next;
+	lock_release(aslist_lock);
+
+	// wait out any eviction in progress, and keep new ones away
+	lock_acquire(as->as_lock);
+	while (as->as_mmaps != NULL) {
+		mm = as->as_mmaps;
+		as->as_mmaps = mm->mm_next;
+		(void)as_free_mmapping(as, mm, NULL);
+	}
+	as_free_ptable(as);
+	lock_release(as->as_lock);
+	lock_destroy(as->as_lock);
+
+	// drop our hold on the executable
+	if (as->as_vnode != NULL) {
+		vfs_close(as->as_vnode);
+	}
+#endif
+	kfree(as);
+}
+
+void
+as_activate(void)
+{
+	int spl;
+#if !OPT_A3
+	int i;
+#endif
+	struct addrspace *as;
+
+
+	as = curproc_getas();
+#ifdef UW
+        /* Kernel threads don't have an address spaces to activate */
+#endif
+	if (as == NULL) {
+#if OPT_A3
+		as_setrefill(NULL);
+#endif
+		return;
+	}
+
+#if OPT_A2 && OPT_A3
+	// so vm_rssstats can say whose it is
+	as->as_pid = curproc->p_pid;
+#endif
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+#if OPT_A3
+	bool flush;
+
+	// our entries can stay in the TLB across switches; it only
+	// needs flushing when the ASIDs get recycled
+	spinlock_acquire(&asid_lock);
+	if (as->as_asidgen != asid_generation) {
+		if (asid_next > ASID_MAX) {
+			if (++asid_generation == 0) {
+				asid_generation = 1;
+			}
+			asid_next = 1;
+			vmstats_inc(VMSTAT_ASID_ROLLOVER);
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_generation;
+		// nobody has entries under the new ASID yet
+		as->as_cpus = 0;
+	}
+	as->as_cpus |= 1U << curcpu->c_number;
+	flush = asid_cpugen[curcpu->c_number] != asid_generation;
+	asid_cpugen[curcpu->c_number] = asid_generation;
+	spinlock_release(&asid_lock);
+
+	if (flush) {
+		tlb_flush();
+	}
+	tlb_setasid(as->as_asid);
+	as_setrefill(as);
+	vmstats_inc(VMSTAT_AS_SWITCH);
+#else
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+#endif
+
+	splx(spl);
+}
+
+void
+as_deactivate(void)
+{
+#if OPT_A3
+	// the address space may be about to go away
+	as_setrefill(NULL);
+#else
+	/* nothing */
+#endif
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	size_t npages; 
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+#if OPT_A3
+	// nothing is copied in through uiomove any more, so catch
+	// segments that reach into kernel space here
+	if (vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
+
+	// the TLB can't deny reads or execution, only writes
+	(void)readable;
+	(void)executable;
+
+	// set up text seg; page table entries come on first touch
+	if (as->as_text_vbase == 0) {
+		as->as_text_vbase = vaddr;
+		as->as_text_npages = npages;
+		as->as_text_writeable = writeable;
+		return 0;
+	}
+
+	// set up data seg
+	if (as->as_data_vbase == 0) {
+		as->as_data_vbase = vaddr;
+		as->as_data_npages = npages;
+		as->as_data_writeable = writeable;
+		return 0;
+	}
+
+#else
+	/* We don't use these - all pages are read-write */
+	(void)readable;
+	(void)writeable;
+	(void)executable;
+
+	if (as->as_vbase1 == 0) {
+		as->as_vbase1 = vaddr;
+		as->as_npages1 = npages;
+		return 0;
+	}
+
+	if (as->as_vbase2 == 0) {
+		as->as_vbase2 = vaddr;
+		as->as_npages2 = npages;
+		return 0;
+	}
+
+#endif
+	/*
+	 * Support for more than two regions is not available.
+	 */
+	kprintf("dumbvm: Warning: too many regions\n");
+	return EUNIMP;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+#if OPT_A3
+	// text and data frames are allocated on first touch by vm_fault
+	(void)as;
+	return 0;
+#else
+	KASSERT(as->as_pbase1 == 0);
+	KASSERT(as->as_pbase2 == 0);
+	KASSERT(as->as_stackpbase == 0);
+
+	as->as_pbase1 = getppages(as->as_npages1);
+	if (as->as_pbase1 == 0) {
+		return ENOMEM;
+	}
+
+	as->as_pbase2 = getppages(as->as_npages2);
+	if (as->as_pbase2 == 0) {
+		return ENOMEM;
+	}
+
+	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	if (as->as_stackpbase == 0) {
+		return ENOMEM;
+	}
+
+	as_zero_region(as->as_pbase1, as->as_npages1);
+	as_zero_region(as->as_pbase2, as->as_npages2);
+	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
+
+	return 0;
+#endif
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+#if OPT_A3
+	lock_acquire(as->as_lock);
+	as->as_loaded = true;
+	// the heap starts out empty, just past whichever segment is higher
+	as->as_heap_vbase = as->as_text_vbase + as->as_text_npages * PAGE_SIZE;
+	if (as->as_heap_vbase <
+	    as->as_data_vbase + as->as_data_npages * PAGE_SIZE) {
+		as->as_heap_vbase =
+			as->as_data_vbase + as->as_data_npages * PAGE_SIZE;
+	}
+	as->as_heap_top = as->as_heap_vbase;
+	lock_release(as->as_lock);
+#else
+	(void)as;
+#endif
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+#if OPT_A3
+	// nothing to allocate; stack pages come on first touch
+	(void)as;
+
+	*stackptr = USERSTACK;
+	return 0;
+#else
+	KASSERT(as->as_stackpbase != 0);
+
+	*stackptr = USERSTACK;
+	return 0;
+#endif
+}
+
+#if OPT_A3
+static struct spinlock stacklimit_lock = SPINLOCK_INITIALIZER;
+static size_t stacklimit = STACK_LIMIT_DEFAULT;
+
+size_t
+as_stacklimit(size_t npages)
+{
+	size_t ret;
+
+	// the whole user address space, at most
+	if (npages > USERSTACK / PAGE_SIZE) {
+		npages = USERSTACK / PAGE_SIZE;
+	}
+
+	spinlock_acquire(&stacklimit_lock);
+	if (npages > 0) {
+		stacklimit = npages;
+	}
+	ret = stacklimit;
+	spinlock_release(&stacklimit_lock);
+	return ret;
+}
+
+static struct spinlock rsslimit_lock = SPINLOCK_INITIALIZER;
+static size_t rsslimit = 0;
+
+size_t
+as_rssdefault(int npages)
+{
+	size_t ret;
+
+	spinlock_acquire(&rsslimit_lock);
+	if (npages >= 0) {
+		rsslimit = npages;
+	}
+	ret = rsslimit;
+	spinlock_release(&rsslimit_lock);
+	return ret;
+}
+
+size_t
+as_rsslimit(struct addrspace *as, int npages)
+{
+	size_t ret;
+
+	lock_acquire(as->as_lock);
+	if (npages >= 0) {
+		as->as_rss_limit = npages;
+		if (npages > 0 && as->as_rss > as->as_rss_limit) {
+			(void)as_trim(as, as->as_rss - as->as_rss_limit);
+		}
+	}
+	ret = as->as_rss_limit;
+	lock_release(as->as_lock);
+	return ret;
+}
+
+void
+vm_rssstats(void)
+{
+	struct addrspace *as;
+	size_t limit;
+
+	limit = as_rssdefault(-1);
+	if (limit == 0) {
+		kprintf("Resident set limit for new programs: none\n");
+	} else {
+		kprintf("Resident set limit for new programs: %lu pages\n",
+			(unsigned long)limit);
+	}
+	kprintf("  pid  resident     limit    faults  page-ins   trimmed\n");
+
+	// the counts are read without as_lock; near enough for this
+	lock_acquire(aslist_lock);
+	for (as = as_all; as != NULL; as = as->as_next) {
+		kprintf("%5d %9lu ", (int)as->as_pid,
+			(unsigned long)as->as_rss);
+		if (as->as_rss_limit == 0) {
+			kprintf("%9s ", "none");
+		} else {
+			kprintf("%9lu ", (unsigned long)as->as_rss_limit);
+		}
+		kprintf("%9u %9u %9u\n", as->as_nfaults, as->as_npageins,
+			as->as_ntrimmed);
+	}
+	lock_release(aslist_lock);
+}
+
+int
+as_define_source(struct addrspace *as, struct vnode *v, off_t offset,
+		 vaddr_t vaddr, size_t memsize, size_t filesize)
+{
+	struct segsource *src;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	if (vaddr >= as->as_text_vbase &&
+	    vaddr < as->as_text_vbase + as->as_text_npages * PAGE_SIZE) {
+		src = &as->as_text_src;
+	} else if (vaddr >= as->as_data_vbase &&
+		   vaddr < as->as_data_vbase + as->as_data_npages * PAGE_SIZE) {
+		src = &as->as_data_src;
+	} else {
+		return ENOEXEC;
 	}
 
-	for (int i = 0; i < (int)as->as_data_npages; i++) {
-		free_kpages(as->as_data_ptable[i].paddr);
-	}
+	DEBUG(DB_EXEC, "ELF: %lu bytes at 0x%lx will page in on demand\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	src->ss_vaddr = vaddr;
+	src->ss_offset = offset;
+	src->ss_filesz = filesize;
 
-	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-		free_kpages(as->as_stack_ptable[i].paddr);
+	// keep the executable open for as long as we might page from it
+	if (as->as_vnode == NULL) {
+		VOP_INCOPEN(v);
+		VOP_INCREF(v);
+		as->as_vnode = v;
 	}
+	KASSERT(as->as_vnode == v);
 
-	// free page tables
-	kfree(as->as_text_ptable);
-	kfree(as->as_data_ptable);
-	kfree(as->as_stack_ptable);
-#endif
-	kfree(as);
+	return 0;
 }
 
-void
-as_activate(void)
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
 {
-	int i, spl;
-	struct addrspace *as;
+	struct tlbbatch tb;
+	struct mmapping *mm;
+	uint32_t *pte;
+	vaddr_t top, newtop, limit, va;
 
+	lock_acquire(as->as_lock);
 
-	as = curproc_getas();
-#ifdef UW
-        /* Kernel threads don't have an address spaces to activate */
-#endif
-	if (as == NULL) {
-		return;
+	top = as->as_heap_top;
+	if (amount < 0 && (vaddr_t)-amount > top - as->as_heap_vbase) {
+		lock_release(as->as_lock);
+		return EINVAL;
 	}
+	newtop = top + amount;
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+	// the stack's whole reservation and mapped files are out of reach
+	limit = USERSTACK - as->as_stack_limit * PAGE_SIZE;
+	for (mm = as->as_mmaps; mm != NULL; mm = mm->mm_next) {
+		if (mm->mm_vbase < limit) {
+			limit = mm->mm_vbase;
+		}
+	}
+	if (amount > 0 && (newtop < top || newtop > limit)) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	// pages wholly past the new break go away now
+	tlbbatch_init(&tb, as);
+	for (va = ROUNDUP(newtop, PAGE_SIZE); va < ROUNDUP(top, PAGE_SIZE);
+	     va += PAGE_SIZE) {
+		pte = as_pte(as, va, false);
+		if (pte == NULL) {
+			// nothing was ever touched in this 4M; on to the next
+			va = (va | (PT_SIZE * PAGE_SIZE - 1)) & PAGE_FRAME;
+			continue;
+		}
+		if (*pte & PTE_RESIDENT) {
+			tlbbatch_add(&tb, va);
+		}
+		if (*pte & PTE_LOCKED) {
+			as->as_nlocked--;
+		}
+		pte_release(as, pte);
 	}
+	as->as_heap_top = newtop;
+	lock_release(as->as_lock);
 
-	splx(spl);
-}
+	tlbbatch_flush(&tb);
 
-void
-as_deactivate(void)
-{
-	/* nothing */
+	*oldbreak = top;
+	return 0;
 }
 
 int
-as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
-		 int readable, int writeable, int executable)
+as_mmap(struct addrspace *as, struct vnode *vn, off_t offset, size_t len,
+	bool writeable, vaddr_t *addrp)
 {
-	size_t npages; 
+	struct mmapping *mm, **mmp;
+	vaddr_t top;
+	size_t npages;
 
-	/* Align the region. First, the base... */
-	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
-	vaddr &= PAGE_FRAME;
+	if (len == 0 || len > USERSTACK || offset < 0 ||
+	    offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
 
-	/* ...and now the length. */
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+	mm = kmalloc(sizeof(struct mmapping));
+	if (mm == NULL) {
+		return ENOMEM;
+	}
+	mm->mm_npages = npages;
+	mm->mm_vnode = vn;
+	mm->mm_offset = offset;
+	mm->mm_writeable = writeable;
+
+	lock_acquire(as->as_lock);
+
+	// take the highest gap below the stack that's big enough
+	top = USERSTACK - as->as_stack_limit * PAGE_SIZE;
+	for (mmp = &as->as_mmaps; *mmp != NULL; mmp = &(*mmp)->mm_next) {
+		if (top - ((*mmp)->mm_vbase + (*mmp)->mm_npages * PAGE_SIZE) >=
+		    npages * PAGE_SIZE) {
+			break;
+		}
+		top = (*mmp)->mm_vbase;
+	}
+	if (*mmp == NULL &&
+	    (top < ROUNDUP(as->as_heap_top, PAGE_SIZE) ||
+	     top - ROUNDUP(as->as_heap_top, PAGE_SIZE) < npages * PAGE_SIZE)) {
+		lock_release(as->as_lock);
+		kfree(mm);
+		return ENOMEM;
+	}
 
-	npages = sz / PAGE_SIZE;
+	mm->mm_vbase = top - npages * PAGE_SIZE;
+	mm->mm_next = *mmp;
+	*mmp = mm;
+	lock_release(as->as_lock);
 
-#if OPT_A3
+	*addrp = mm->mm_vbase;
+	return 0;
+}
 
-	// set up text seg
-	if (as->as_text_vbase == 0) {
-		as->as_text_ptable = kmalloc(npages * sizeof(struct pagetable));
-		for (int i = 0; i < (int)npages; i++) {
-			as->as_text_ptable[i].readable = readable;
-			as->as_text_ptable[i].writeable = writeable;
-			as->as_text_ptable[i].executable = executable;
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct tlbbatch tb;
+	struct mmapping *mm, **mmp;
+	int result;
+
+	lock_acquire(as->as_lock);
+	for (mmp = &as->as_mmaps; *mmp != NULL; mmp = &(*mmp)->mm_next) {
+		if ((*mmp)->mm_vbase == addr) {
+			break;
 		}
-		as->as_text_vbase = vaddr;
-		as->as_text_npages = npages;
-		return 0;
 	}
+	mm = *mmp;
+	// only whole mappings
+	if (mm == NULL || ROUNDUP(len, PAGE_SIZE) != mm->mm_npages * PAGE_SIZE) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	*mmp = mm->mm_next;
+	tlbbatch_init(&tb, as);
+	result = as_free_mmapping(as, mm, &tb);
+	lock_release(as->as_lock);
 
-	// set up data seg
-	if (as->as_data_vbase == 0) {
-		as->as_data_ptable = kmalloc(npages * sizeof(struct pagetable));
-		for (int i = 0; i < (int)npages; i++) {
-			as->as_data_ptable[i].readable = readable;
-			as->as_data_ptable[i].writeable = writeable;
-			as->as_data_ptable[i].executable = executable;
+	tlbbatch_flush(&tb);
+	return result;
+}
+
+/*
+ * Check that the NPAGES pages from VADDR all exist: ENOMEM if any of
+ * them isn't in a segment, as for a bad range in the calls below.
+ */
+static
+int
+as_checkrange(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	size_t i;
+
+	for (i = 0; i < npages; i++) {
+		if (!as_lookup(as, vaddr + i * PAGE_SIZE, NULL, NULL, NULL)) {
+			return ENOMEM;
 		}
-		as->as_data_vbase = vaddr;
-		as->as_data_npages = npages;
+	}
+	return 0;
+}
+
+/* Page count of LEN bytes at ADDR, or 0 if that's not in user space. */
+static
+size_t
+as_rangepages(vaddr_t addr, size_t len)
+{
+	if (len > USERSTACK || addr > USERSTACK - len) {
 		return 0;
 	}
+	return DIVROUNDUP(len, PAGE_SIZE);
+}
 
-#else
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	(void)executable;
+int
+as_madvise(struct addrspace *as, vaddr_t addr, size_t len, int advice)
+{
+	struct tlbbatch tb;
+	struct mmapping *mm;
+	uint32_t *pte, keep;
+	vaddr_t va;
+	size_t npages, i;
+	int result;
+
+	if (addr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+	    case MADV_WILLNEED:
+	    case MADV_DONTNEED:
+		break;
+	    default:
+		return EINVAL;
+	}
+	npages = as_rangepages(addr, len);
+	if (npages == 0) {
+		return len == 0 ? 0 : ENOMEM;
+	}
+	tlbbatch_init(&tb, as);
 
-	if (as->as_vbase1 == 0) {
-		as->as_vbase1 = vaddr;
-		as->as_npages1 = npages;
-		return 0;
+	lock_acquire(as->as_lock);
+	result = as_checkrange(as, addr, npages);
+	if (result) {
+		goto done;
 	}
 
-	if (as->as_vbase2 == 0) {
-		as->as_vbase2 = vaddr;
-		as->as_npages2 = npages;
-		return 0;
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+		// there's no read-ahead unless asked for
+		for (i = 0; i < npages; i++) {
+			pte = as_pte(as, addr + i * PAGE_SIZE, false);
+			if (pte != NULL) {
+				*pte &= ~PTE_SEQ;
+			}
+		}
+		break;
+
+	    case MADV_SEQUENTIAL:
+		for (i = 0; i < npages; i++) {
+			pte = as_pte(as, addr + i * PAGE_SIZE, true);
+			if (pte == NULL) {
+				result = ENOMEM;
+				goto done;
+			}
+			*pte |= PTE_SEQ;
+		}
+		break;
+
+	    case MADV_WILLNEED:
+		as_prefetch(as, addr, npages, false);
+		break;
+
+	    case MADV_DONTNEED:
+		for (i = 0; i < npages; i++) {
+			pte = as_pte(as, addr + i * PAGE_SIZE, false);
+			if (pte != NULL && (*pte & PTE_LOCKED)) {
+				result = EINVAL;
+				goto done;
+			}
+		}
+		// next use starts over: from the file, or zero-filled
+		for (i = 0; i < npages; i++) {
+			va = addr + i * PAGE_SIZE;
+			pte = as_pte(as, va, false);
+			if (pte == NULL) {
+				continue;
+			}
+			if (*pte & PTE_RESIDENT) {
+				tlbbatch_add(&tb, va);
+			}
+			keep = *pte & PTE_KEEP;
+			if ((*pte & PTE_SHARED) && (*pte & PTE_RESIDENT)) {
+				// the file keeps what was written; the
+				// cache can let go of the frame now
+				(void)as_lookup(as, va, NULL, NULL, &mm);
+				KASSERT(mm != NULL);
+				(void)pagecache_put(mm->mm_vnode,
+					mm->mm_offset + (va - mm->mm_vbase),
+					PTE_PADDR(*pte));
+				*pte = 0;
+				as->as_rss--;
+			} else {
+				pte_release(as, pte);
+			}
+			*pte = keep;
+		}
+		break;
 	}
 
-#endif
-	/*
-	 * Support for more than two regions is not available.
-	 */
-	kprintf("dumbvm: Warning: too many regions\n");
-	return EUNIMP;
+ done:
+	lock_release(as->as_lock);
+	tlbbatch_flush(&tb);
+	return result;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
+int
+as_mincore(struct addrspace *as, vaddr_t addr, size_t npages,
+	   unsigned char *vec)
 {
-#if OPT_A3
-	(void)paddr;
-	(void)npages;
-#else
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
-#endif
+	uint32_t *pte;
+	size_t i;
+	int result;
+
+	if (addr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (as_rangepages(addr, npages * PAGE_SIZE) != npages) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->as_lock);
+	result = as_checkrange(as, addr, npages);
+	if (result == 0) {
+		for (i = 0; i < npages; i++) {
+			pte = as_pte(as, addr + i * PAGE_SIZE, false);
+			vec[i] = (pte != NULL && (*pte & PTE_RESIDENT)) ? 1 : 0;
+		}
+	}
+	lock_release(as->as_lock);
+	return result;
 }
 
+/*
+ * Locked pages are brought in and their frames taken off the clock
+ * (as_mapframe); private copies are made of writeable cow pages first,
+ * since the copy would otherwise be a fresh, unlocked frame. Shared
+ * frames can't be evicted anyway while we hold them.
+ */
 int
-as_prepare_load(struct addrspace *as)
+as_mlock(struct addrspace *as, vaddr_t addr, size_t len, bool lock)
 {
-#if OPT_A3
-	// preallocate frames for each page in the segment
-	//vaddr_t text_vaddr = as->as_text_vbase;
-	for (int i = 0; i < (int)as->as_text_npages; i++) {
-		as->as_text_ptable[i].frame = i;
-		// allocate each frame one at a time
-		as->as_text_ptable[i].paddr = getppages(1);
-		if (as->as_text_ptable[i].paddr == 0) {
-			return ENOMEM;
+	struct tlbbatch tb;
+	struct segsource *src;
+	struct mmapping *mm;
+	uint32_t *pte;
+	vaddr_t va;
+	size_t npages, nnew, i;
+	bool writeable;
+	int result;
+
+	if (addr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	npages = as_rangepages(addr, len);
+	if (npages == 0) {
+		return len == 0 ? 0 : ENOMEM;
+	}
+	tlbbatch_init(&tb, as);
+
+	lock_acquire(as->as_lock);
+	result = as_checkrange(as, addr, npages);
+	if (result) {
+		goto done;
+	}
+
+	if (!lock) {
+		for (i = 0; i < npages; i++) {
+			va = addr + i * PAGE_SIZE;
+			pte = as_pte(as, va, false);
+			if (pte == NULL || (*pte & PTE_LOCKED) == 0) {
+				continue;
+			}
+			KASSERT(*pte & PTE_RESIDENT);
+			*pte &= ~PTE_LOCKED;
+			as->as_nlocked--;
+			if ((*pte & (PTE_COW | PTE_SHARED)) == 0) {
+				as_mapframe(as, va, pte);
+			}
 		}
-	//	text_vaddr += PAGE_SIZE;
+		goto done;
 	}
 
-	//vaddr_t data_vaddr = as->as_data_vbase;
-	for (int i = 0; i < (int)as->as_data_npages; i++) {
-		as->as_data_ptable[i].frame = i;
-		// allocate each frame one at a time
-		as->as_data_ptable[i].paddr = getppages(1);
-		if (as->as_data_ptable[i].paddr == 0) {
-			return ENOMEM;
+	nnew = 0;
+	for (i = 0; i < npages; i++) {
+		pte = as_pte(as, addr + i * PAGE_SIZE, false);
+		if (pte == NULL || (*pte & PTE_LOCKED) == 0) {
+			nnew++;
 		}
-	//	data_vaddr += PAGE_SIZE;
+	}
+	if (as->as_nlocked + nnew > MLOCK_LIMIT) {
+		result = ENOMEM;
+		goto done;
 	}
 
-/*	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-		as->as_stack_ptable[i].vaddr = data_vaddr; // virtual memory is contiguous
-		// allocate each frame one at a time
-		as->as_stack_ptable[i].paddr = getppages(1);
-		if (as->as_stack_ptable[i].paddr == 0) {
-			return ENOMEM;
+	// anything locked before a failure stays locked
+	for (i = 0; i < npages; i++) {
+		va = addr + i * PAGE_SIZE;
+		(void)as_lookup(as, va, &writeable, &src, &mm);
+		pte = as_pte(as, va, true);
+		if (pte == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		if (*pte & PTE_LOCKED) {
+			continue;
+		}
+		if ((*pte & PTE_RESIDENT) == 0) {
+			result = as_page_in(as, va, pte, writeable, src, mm,
+					    false);
+			if (result) {
+				break;
+			}
+			pte_ready(pte);
 		}
-		data_vaddr += PAGE_SIZE;
-	}*/
 
-	as_zero_region(as->as_text_ptable[0].paddr, as->as_text_npages); // avoid warning
+		*pte |= PTE_LOCKED;
+		if (writeable && (*pte & PTE_COW)) {
+			result = as_break_cow(as, va, pte, &tb);
+			if (result) {
+				*pte &= ~PTE_LOCKED;
+				break;
+			}
+			pte_ready(pte);
+		} else if ((*pte & (PTE_COW | PTE_SHARED)) == 0) {
+			as_mapframe(as, va, pte);
+		}
+		as->as_nlocked++;
+	}
 
-	return 0;
-#else
-	KASSERT(as->as_pbase1 == 0);
-	KASSERT(as->as_pbase2 == 0);
-	KASSERT(as->as_stackpbase == 0);
+ done:
+	lock_release(as->as_lock);
+	// other TLBs may still have the frames we copied
+	tlbbatch_flush(&tb);
+	return result;
+}
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
-		return ENOMEM;
+/*
+ * Protections are kept per page, as PTE_NOWRITE and PTE_NOREAD, and
+ * only ever take away from what the segment allows. Taking access
+ * away has to reach the TLBs: a handful of pages are shot down like
+ * evicted ones, more than a batch by moving to a new ASID. Giving it
+ * back needs nothing, since the next use faults and vm_fault fixes
+ * the entry up.
+ */
+int
+as_mprotect(struct addrspace *as, vaddr_t addr, size_t len, int prot)
+{
+	struct tlbbatch tb;
+	uint32_t *pte, bits, old;
+	vaddr_t va;
+	size_t npages, i;
+	bool writeable;
+	int result;
+
+	if (addr % PAGE_SIZE != 0 ||
+	    (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
 	}
+	npages = as_rangepages(addr, len);
+	if (npages == 0) {
+		return len == 0 ? 0 : ENOMEM;
+	}
+	tlbbatch_init(&tb, as);
 
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
-		return ENOMEM;
+	// there's no executing without reading, or writing without it
+	bits = 0;
+	if ((prot & PROT_WRITE) == 0) {
+		bits |= PTE_NOWRITE;
+	}
+	if (prot == PROT_NONE) {
+		bits |= PTE_NOREAD;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (as->as_stackpbase == 0) {
-		return ENOMEM;
+	lock_acquire(as->as_lock);
+	result = as_checkrange(as, addr, npages);
+	if (result) {
+		goto done;
+	}
+	for (i = 0; i < npages && (prot & PROT_WRITE); i++) {
+		(void)as_lookup(as, addr + i * PAGE_SIZE, &writeable,
+				NULL, NULL);
+		if (!writeable) {
+			result = EACCES;
+			goto done;
+		}
 	}
-	
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
 
-	return 0;
-#endif
+	for (i = 0; i < npages; i++) {
+		va = addr + i * PAGE_SIZE;
+		pte = as_pte(as, va, bits != 0);
+		if (pte == NULL) {
+			if (bits != 0) {
+				result = ENOMEM;
+				break;
+			}
+			continue;
+		}
+		old = *pte;
+		*pte = (*pte & ~(PTE_NOWRITE | PTE_NOREAD)) | bits;
+		if (bits & PTE_NOWRITE) {
+			*pte &= ~TLBLO_DIRTY;
+		}
+		if (bits & PTE_NOREAD) {
+			*pte &= ~TLBLO_VALID;
+		}
+		// TLBLO_VALID clear doesn't mean no TLB has the page:
+		// the clock only invalidates on its own cpu
+		if ((old & TLBLO_DIRTY & ~*pte) == 0 &&
+		    ((old & PTE_RESIDENT) == 0 ||
+		     (~old & *pte & PTE_NOREAD) == 0)) {
+			continue;
+		}
+
+		// a TLB somewhere may still allow what's been taken away
+		tlbbatch_add(&tb, va);
+	}
+
+ done:
+	lock_release(as->as_lock);
+	tlbbatch_flush(&tb);
+	return result;
 }
 
+/*
+ * Give NEW the same file mappings as OLD. Their pages come over with
+ * the rest of the page table (as_copy_ptable).
+ */
+static
 int
-as_complete_load(struct addrspace *as)
+as_copy_mmaps(struct addrspace *old, struct addrspace *new)
 {
-#if OPT_A3
-	as->as_loaded = true;
-#else
-	(void)as;
-#endif
+	struct mmapping *mm, *nmm, **tailp;
+
+	tailp = &new->as_mmaps;
+	for (mm = old->as_mmaps; mm != NULL; mm = mm->mm_next) {
+		nmm = kmalloc(sizeof(struct mmapping));
+		if (nmm == NULL) {
+			return ENOMEM;
+		}
+		VOP_INCOPEN(mm->mm_vnode);
+		VOP_INCREF(mm->mm_vnode);
+		nmm->mm_vbase = mm->mm_vbase;
+		nmm->mm_npages = mm->mm_npages;
+		nmm->mm_vnode = mm->mm_vnode;
+		nmm->mm_offset = mm->mm_offset;
+		nmm->mm_writeable = mm->mm_writeable;
+		nmm->mm_next = NULL;
+		*tailp = nmm;
+		tailp = &nmm->mm_next;
+	}
 	return 0;
 }
 
+/*
+ * Fill in NEW's page table from OLD's. Resident pages are not copied:
+ * both sides take a reference to the same frame and mark it cow, so
+ * that whoever writes first gets a private copy, and both lose write
+ * access in the meantime; the pages OLD could write go in TB, for
+ * their TLB entries to be flushed. Mapped file pages are simply
+ * shared. Pages out in swap share the slot instead; each side reads
+ * its own copy back in. Pages that were never touched stay that way,
+ * and so do 4M chunks without any.
+ */
+static
 int
-as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+as_copy_ptable(struct addrspace *old, struct addrspace *new,
+	       struct tlbbatch *tb)
 {
-#if OPT_A3
-	// always allocate NUM_STACK_PAGES for the stack
-	// need to create a page table for the stack
-	as->as_stack_ptable = kmalloc(DUMBVM_STACKPAGES * sizeof(struct pagetable));
-
-	// need to allocate frames for the stack
-	//vaddr_t stack_vaddr = USERSTACK;
-	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-		as->as_stack_ptable[i].frame = i;
-		// allocate each frame one at a time
-		as->as_stack_ptable[i].paddr = getppages(1);
-		if (as->as_stack_ptable[i].paddr == 0) {
+	uint32_t *ol2, *nl2;
+	unsigned i, j;
+
+	for (i = 0; i < PT_SIZE; i++) {
+		ol2 = old->as_ptable[i];
+		if (ol2 == NULL) {
+			continue;
+		}
+		nl2 = pt_getpage();
+		if (nl2 == NULL) {
 			return ENOMEM;
 		}
-	//	stack_vaddr += PAGE_SIZE;
+		new->as_ptable[i] = nl2;
+
+		for (j = 0; j < PT_SIZE; j++) {
+			if (ol2[j] & PTE_RESIDENT) {
+				coremap_incref(PTE_PADDR(ol2[j]));
+				new->as_rss++;
+				if ((ol2[j] & PTE_SHARED) == 0) {
+					// only a writeable entry can be
+					// in a TLB writeable
+					if (ol2[j] & TLBLO_DIRTY) {
+						tlbbatch_add(tb,
+						    (i * PT_SIZE + j) *
+						    PAGE_SIZE);
+					}
+					ol2[j] |= PTE_COW;
+					ol2[j] &= ~TLBLO_DIRTY;
+				}
+			} else if (ol2[j] & PTE_SWAPPED) {
+				swap_incref(PTE_SLOT(ol2[j]));
+			}
+			// locks aren't inherited
+			nl2[j] = ol2[j] & ~PTE_LOCKED;
+		}
 	}
-
-	*stackptr = USERSTACK;
-	return 0;
-#else
-	KASSERT(as->as_stackpbase != 0);
-
-	*stackptr = USERSTACK;
 	return 0;
-#endif
 }
+#endif
 
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
@@ -673,42 +3304,51 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	// create segments based on old addrspace
 	new->as_text_vbase = old->as_text_vbase;
 	new->as_text_npages = old->as_text_npages;
+	new->as_text_writeable = old->as_text_writeable;
+	new->as_text_src = old->as_text_src;
 	new->as_data_vbase = old->as_data_vbase;
 	new->as_data_npages = old->as_data_npages;
-
-	// alloc frames for segs
-	if (as_prepare_load(new)) {
-		as_destroy(new);
-		return ENOMEM;
-	}
-	new->as_text_ptable = kmalloc(new->as_text_npages * sizeof(struct pagetable));
-	new->as_data_ptable = kmalloc(new->as_data_npages * sizeof(struct pagetable));
-	if (as_define_stack(new, (vaddr_t *)USERSTACK)) {
-		as_destroy(new);
-		return ENOMEM;
+	new->as_data_writeable = old->as_data_writeable;
+	new->as_data_src = old->as_data_src;
+	new->as_stack_limit = old->as_stack_limit;
+	new->as_rss_limit = old->as_rss_limit;
+	new->as_heap_vbase = old->as_heap_vbase;
+	new->as_heap_top = old->as_heap_top;
+	new->as_loaded = old->as_loaded;
+
+	// untouched pages in the child page in from the same file
+	if (old->as_vnode != NULL) {
+		VOP_INCOPEN(old->as_vnode);
+		VOP_INCREF(old->as_vnode);
+		new->as_vnode = old->as_vnode;
 	}
 
-	// memcpy frames from old addrspace to frames in new addrspace
-	for (int i = 0; i < (int)new->as_text_npages; i++) {
-		//copyout(new->as_text_ptable[i], old->as_text_ptable[i], sizeof(struct pagetable));
-		memcpy((void *)PADDR_TO_KVADDR(new->as_text_ptable[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->as_text_ptable[i].paddr),
-			PAGE_SIZE);
-	}
-	for (int i = 0; i < (int)new->as_data_npages; i++) {
-		//copyout(new->as_data_ptable[i], old->as_data_ptable[i], sizeof(struct pagetable));
-		memcpy((void *)PADDR_TO_KVADDR(new->as_text_ptable[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->as_text_ptable[i].paddr),
-			PAGE_SIZE);
+	struct tlbbatch tb;
+
+	// hold the parent still while we take our references
+	tlbbatch_init(&tb, old);
+	lock_acquire(old->as_lock);
+	if (as_copy_ptable(old, new, &tb)) {
+		goto fail;
 	}
-	for (int i = 0; i < DUMBVM_STACKPAGES; i++) {
-		memcpy((void *)PADDR_TO_KVADDR(new->as_stack_ptable[i].paddr),
-			(const void *)PADDR_TO_KVADDR(old->as_stack_ptable[i].paddr),
-			PAGE_SIZE);
+	if (as_copy_mmaps(old, new)) {
+		goto fail;
 	}
+	lock_release(old->as_lock);
+
+	// the parent's TLB may still allow writes to frames that are
+	// now shared. Old is always the current
+	// address space (sys_fork).
+	tlbbatch_flush(&tb);
 
 	*ret = new;
 	return 0;
+
+ fail:
+	lock_release(old->as_lock);
+	tlbbatch_flush(&tb);
+	as_destroy(new);
+	return ENOMEM;
 #else
 
 	new->as_vbase1 = old->as_vbase1;
@@ -737,7 +3377,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
-	
+
 	*ret = new;
 	return 0;
 #endif
@@ -38,13 +38,28 @@
 #include <vm.h>
 
 #if OPT_A3
-struct pagetable {
-	int frame;
-	paddr_t paddr;
-	bool readable;
-	bool writeable;
-	bool executable;
+/* where a segment's initialized contents live in the executable */
+struct segsource {
+	vaddr_t ss_vaddr;	/* first byte backed by the file */
+	off_t ss_offset;	/* file offset of ss_vaddr */
+	size_t ss_filesz;	/* bytes backed by the file; the rest is zero */
 };
+
+/* a file mapped into an address space with mmap */
+struct mmapping {
+	vaddr_t mm_vbase;
+	size_t mm_npages;
+	struct vnode *mm_vnode;	/* open file; pages are in its page cache */
+	off_t mm_offset;	/* file offset of mm_vbase */
+	bool mm_writeable;
+	struct mmapping *mm_next;	/* next lower mapping */
+};
+
+/* stack limit, in pages, for address spaces made by as_create */
+#define STACK_LIMIT_DEFAULT  1024
+
+/* most pages one address space may have locked in memory (1M) */
+#define MLOCK_LIMIT  256
 #endif
 
 struct vnode;
@@ -60,13 +75,33 @@ struct vnode;
 #if OPT_A3
 struct addrspace {
   vaddr_t as_text_vbase;
-  struct pagetable *as_text_ptable;
   size_t as_text_npages;
+  bool as_text_writeable;
   vaddr_t as_data_vbase;
-  struct pagetable *as_data_ptable;
   size_t as_data_npages;
-  struct pagetable *as_stack_ptable;
+  bool as_data_writeable;
+  size_t as_stack_limit;  // pages below USERSTACK the stack may use
+  vaddr_t as_heap_vbase;  // heap starts right after text and data
+  vaddr_t as_heap_top;    // current break; pages up to it are valid
+  struct mmapping *as_mmaps; // between heap and stack, highest first
   bool as_loaded;
+  struct vnode *as_vnode; // executable that text/data are paged in from
+  struct segsource as_text_src;
+  struct segsource as_data_src;
+  struct lock *as_lock; // page table; held across faults and eviction
+  unsigned as_asid;     // hardware address space ID (TLBHI_PID)
+  uint32_t as_asidgen;  // ASID generation as_asid belongs to; 0 = none
+  uint32_t as_cpus;     // cpus that may have TLB entries under as_asid
+  uint32_t **as_ptable; // two-level, TLBLO entries; see dumbvm.c
+  size_t as_nlocked;    // pages locked with mlock
+  size_t as_rss;        // resident pages, shared ones included
+  size_t as_rss_limit;  // most resident pages; 0 for no limit
+  unsigned as_rss_hand; // page number local replacement looks at next
+  unsigned as_nfaults;  // TLB faults that went through vm_fault
+  unsigned as_npageins; // of those, pages that had to be brought in
+  unsigned as_ntrimmed; // pages pushed out to stay under the limit
+  pid_t as_pid;         // process that last ran in it
+  struct addrspace *as_next; // all address spaces, for vm_rssstats
 };
 #else
 struct addrspace {
@@ -114,6 +149,66 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_source - record that the segment containing VADDR is
+ *                backed by FILESZ bytes of vnode V at OFFSET. Pages
+ *                are read in from there by vm_fault on first touch
+ *                instead of being loaded up front.
+ *
+ *    as_unreference - make the next use of page VADDR go through
+ *                vm_fault, so the page replacement clock hears about
+ *                it. Only drops cached translations; never sleeps.
+ *
+ *    as_sbrk   - move the break of the heap in AS by AMOUNT bytes and
+ *                hand back the old one. Pages are allocated on first
+ *                touch; shrinking frees the pages past the new break.
+ *                AS must be the current address space.
+ *
+ *    as_mmap   - map LEN bytes of open file VN from OFFSET, shared, at
+ *                a free address chosen below the stack, and hand the
+ *                address back. The mapping takes over the caller's
+ *                open of VN. Pages are read through the page cache on
+ *                first touch.
+ *
+ *    as_munmap - remove the mapping at ADDR, which must be LEN bytes
+ *                long, writing its dirty pages back to the file.
+ *
+ *    as_stacklimit - get the stack limit (in pages) new address spaces
+ *                start with, first setting it to NPAGES if that's
+ *                nonzero. A forked address space keeps its parent's.
+ *
+ *    as_madvise - take ADVICE (MADV_*) about the LEN bytes at ADDR:
+ *                read ahead after faults there (SEQUENTIAL) or not
+ *                (NORMAL, RANDOM), bring the pages in now (WILLNEED),
+ *                or drop them, so that the next use starts over from
+ *                the file or zero (DONTNEED). AS must be current.
+ *
+ *    as_mincore - set VEC[i] to 1 if page i of the NPAGES at ADDR is
+ *                in memory, 0 if not.
+ *
+ *    as_mlock  - bring the pages of the LEN bytes at ADDR in and keep
+ *                them there until unlocked (LOCK false), the memory
+ *                goes away, or the process exits. Not inherited by
+ *                fork. AS must be current.
+ *
+ *    as_mprotect - allow PROT (PROT_*) on the pages of the LEN bytes at
+ *                ADDR: reads and writes, reads only, or nothing at all
+ *                (PROT_NONE). Pages can't be made writeable in a
+ *                read-only segment (EACCES). AS must be current.
+ *
+ *    In all four, ADDR must be page aligned (EINVAL), and every page
+ *    of the range must be in the address space (ENOMEM).
+ *
+ *    as_rsslimit - get the most pages AS may have resident at once (0
+ *                for no limit), first setting it to NPAGES if that
+ *                isn't negative. A process over its limit makes room
+ *                by pushing out its own pages, not other people's;
+ *                lowering the limit does so at once. Forks inherit
+ *                the limit, and so does exec, as with other rlimits;
+ *                only processes the kernel starts get the default.
+ *
+ *    as_rssdefault - get the limit as_create gives new address spaces,
+ *                first setting it to NPAGES if that isn't negative.
  */
 
 struct addrspace *as_create(void);
@@ -130,6 +225,29 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int               as_define_source(struct addrspace *as, struct vnode *v,
+                                   off_t offset, vaddr_t vaddr,
+                                   size_t memsize, size_t filesize);
+void              as_unreference(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, struct vnode *vn,
+                          off_t offset, size_t len, bool writeable,
+                          vaddr_t *addrp);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+size_t            as_stacklimit(size_t npages);
+int               as_madvise(struct addrspace *as, vaddr_t addr, size_t len,
+                             int advice);
+int               as_mincore(struct addrspace *as, vaddr_t addr,
+                             size_t npages, unsigned char *vec);
+int               as_mlock(struct addrspace *as, vaddr_t addr, size_t len,
+                           bool lock);
+int               as_mprotect(struct addrspace *as, vaddr_t addr, size_t len,
+                              int prot);
+size_t            as_rsslimit(struct addrspace *as, int npages);
+size_t            as_rssdefault(int npages);
+#endif
 
 
 /*
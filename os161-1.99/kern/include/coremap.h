@@ -0,0 +1,189 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical frame manager (coremap).
+ *
+ * All of physical memory left over after boot is handed out by a
+ * binary buddy allocator. Free blocks of 2^order frames sit on one
+ * free list per order; an allocation splits the smallest block that
+ * fits, and a free coalesces the block with its buddy for as long as
+ * the buddy is also free. Both are O(log n) in the number of frames.
+ *
+ * Per-frame metadata is a small fixed-size record indexed directly by
+ * physical frame number, so going from an address to its frame is a
+ * subtraction and a shift. The free list links themselves live inside
+ * the free frames.
+ */
+
+#include <types.h>
+
+/* Who a block of frames belongs to. */
+#define CM_FREE     0		/* on a free list */
+#define CM_KERNEL   1		/* kernel heap (alloc_kpages) */
+#define CM_USER     2		/* user page, possibly shared */
+#define CM_PTABLE   3		/* page-table page */
+#define CM_ZSWAP    4		/* compressed swap pool */
+#define CM_ZERO     5		/* zeroed and waiting in the pool */
+#define CM_CACHED   6		/* free in a per-cpu frame cache */
+#define CM_NOWNERS  7
+
+/* Largest block we keep track of: 2^CM_MAXORDER frames (16M). */
+#define CM_MAXORDER  12
+
+/* Set up the frame manager; called once from vm_bootstrap. */
+void coremap_bootstrap(void);
+
+/* True once coremap_bootstrap has run. */
+bool coremap_ready(void);
+
+/*
+ * coremap_alloc  - allocate NPAGES physically contiguous frames on
+ *                  behalf of OWNER and return the physical address of
+ *                  the first, or 0 if no block is large enough. The
+ *                  block is rounded up to the next power of two and
+ *                  starts out with a reference count of 1. Single
+ *                  frames come from, and are freed to, a small cache
+ *                  on the current cpu when they can.
+ *
+ * coremap_free   - release a block previously returned by
+ *                  coremap_alloc, given the address of its first frame,
+ *                  regardless of its reference count.
+ *
+ * coremap_incref - take another reference to the block at PADDR.
+ *                  A shared frame has no recorded mapping (see below).
+ *
+ * coremap_decref - drop a reference to the block at PADDR, freeing it
+ *                  when the last one goes away. Returns the number of
+ *                  references left.
+ *
+ * coremap_refcount, coremap_owner - inspect a block's metadata.
+ */
+paddr_t coremap_alloc(unsigned long npages, int owner);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+unsigned coremap_decref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+int coremap_owner(paddr_t paddr);
+
+/*
+ * Page replacement support. Only user frames with a single reference
+ * and a recorded mapping are candidates for eviction.
+ *
+ * coremap_map       - record that the user frame at PADDR holds page
+ *                     VADDR of AS, making it evictable, or forget the
+ *                     mapping if AS is NULL. Counts as a reference.
+ *
+ * coremap_reference - note that the frame at PADDR was just used.
+ *
+ * coremap_testref   - whether the frame at PADDR was used since the
+ *                     last time we asked, for a clock of one's own.
+ *
+ * coremap_victim    - run the clock (second chance on CF_REF) and
+ *                     return a frame to evict, or 0 if there is none.
+ *                     The frame is marked busy and the owning address
+ *                     space's as_lock is held on return; *LOCKEDP says
+ *                     whether we took it (and must release it) or the
+ *                     caller already held it. Never sleeps.
+ *
+ * coremap_unbusy    - give up on evicting PADDR after all.
+ *
+ * coremap_scan      - like coremap_victim, but just the next frame with
+ *                     a mapping from frame *CURSORP on, whose address
+ *                     space we could lock, and no clock. Returns 0 and
+ *                     sets *CURSORP back to 0 at the end of memory.
+ *
+ * coremap_lockmapping - if PADDR is (still) a user frame with a
+ *                     mapping, lock its address space as above and
+ *                     say where it's mapped. The frame may have been
+ *                     freed and reused since the caller last saw it.
+ *
+ * Clean frames, which eviction can drop without writing anything:
+ *
+ * coremap_setclean  - the user frame at PADDR was just filled from swap
+ *                     slot SLOT, which it now holds the reference to,
+ *                     or from its page's own source (SLOT -1).
+ *
+ * coremap_getclean  - whether PADDR is still clean, and its slot (or
+ *                     -1) in *SLOTP.
+ *
+ * coremap_setdirty  - PADDR may be written from now on. Returns the
+ *                     slot it was holding, or -1; the caller releases
+ *                     it. Frames start out dirty.
+ */
+struct addrspace;
+void coremap_map(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_reference(paddr_t paddr);
+bool coremap_testref(paddr_t paddr);
+paddr_t coremap_victim(struct addrspace **asp, vaddr_t *vaddrp,
+		       bool *lockedp);
+void coremap_unbusy(paddr_t paddr);
+paddr_t coremap_scan(unsigned *cursorp, struct addrspace **asp,
+		     vaddr_t *vaddrp, bool *lockedp);
+bool coremap_lockmapping(paddr_t paddr, struct addrspace **asp,
+			 vaddr_t *vaddrp, bool *lockedp);
+void coremap_setclean(paddr_t paddr, int slot);
+bool coremap_getclean(paddr_t paddr, int *slotp);
+int coremap_setdirty(paddr_t paddr);
+
+/*
+ * Compaction, for when a multi-frame allocation fails with enough
+ * memory free, just not in one piece. Single user frames are moved
+ * out of the way; the VM system does the moving, since only it knows
+ * where they're mapped.
+ *
+ * coremap_fragindex     - how much an NPAGES allocation would fail
+ *                         because of fragmentation, in thousandths:
+ *                         near 0 if there's just too little memory
+ *                         free (compaction won't help), near 1000 if
+ *                         it's in small pieces (it will). -1 if the
+ *                         allocation would succeed.
+ *
+ * coremap_compact_begin - pick the block of NPAGES (rounded up to a
+ *                         power of two) that's cheapest to empty,
+ *                         and keep its free frames from everyone
+ *                         else. Returns its address, or 0 if no block
+ *                         has only free frames and movable ones, or
+ *                         not enough memory is free to move them to.
+ *                         The per-cpu cache and the zero pool are
+ *                         emptied first.
+ *
+ * coremap_isolate       - the user page in the frame at PADDR has been
+ *                         moved elsewhere; keep the frame for the
+ *                         block being emptied instead of freeing it.
+ *
+ * coremap_compact_end   - if every frame of the block at BASE is free
+ *                         for us now, allocate it to OWNER and return
+ *                         BASE. If not, let go of what we kept and
+ *                         return 0.
+ */
+int coremap_fragindex(unsigned long npages);
+paddr_t coremap_compact_begin(unsigned long npages);
+void coremap_isolate(paddr_t paddr);
+paddr_t coremap_compact_end(paddr_t base, unsigned long npages, int owner);
+
+/*
+ * Pre-zeroed frames. Idle cpus keep a pool of zeroed frames topped up
+ * to a watermark, so that most zero-fill faults needn't clear a page
+ * themselves. Pool frames are handed back to the free lists whenever
+ * an allocation would otherwise fail.
+ *
+ * coremap_alloc_zeroed - like coremap_alloc for a single frame, but the
+ *                        frame is zero-filled: from the pool if it has
+ *                        one (a hit), cleared here if not (a miss).
+ *
+ * coremap_zerofill     - zero one more frame for the pool. Called from
+ *                        the idle loop at splhigh, but takes interrupts
+ *                        between chunks of the page; returns false if
+ *                        the pool is full or there's no memory for it.
+ */
+paddr_t coremap_alloc_zeroed(int owner);
+bool coremap_zerofill(void);
+
+/*
+ * Print per-owner usage, free blocks and fragmentation index per
+ * order, and the per-cpu frame cache hit rates (kernel menu "cm").
+ */
+void coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
@@ -152,6 +152,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_cpus sends N mappings, in one IPI per CPU, to each
+ * CPU other than the current one whose bit (1 << c_number) is set in
+ * CPUS; it returns the number of CPUs it was sent to, and the number
+ * it left out in *SKIPPED.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +170,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_cpus(uint32_t cpus,
+			       const struct tlbshootdown *mappings,
+			       unsigned n, unsigned *skipped);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,27 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Protection bits for mmap() and mprotect(). There's no way to map a
+ * page the hardware can't read, so PROT_EXEC and PROT_WRITE imply
+ * PROT_READ. mmap() makes PROT_NONE mappings readable anyway;
+ * mprotect() makes such pages inaccessible.
+ */
+
+#define PROT_NONE     0      /* No access */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/*
+ * Advice for madvise().
+ */
+
+#define MADV_NORMAL     0    /* No particular pattern */
+#define MADV_RANDOM     1    /* No read-ahead (same as NORMAL here) */
+#define MADV_SEQUENTIAL 2    /* Read ahead after each page fault */
+#define MADV_WILLNEED   3    /* Bring the pages in now */
+#define MADV_DONTNEED   4    /* Drop the pages; contents start over */
+
+
+#endif /* _KERN_MMAN_H_ */
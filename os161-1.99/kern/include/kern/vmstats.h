@@ -0,0 +1,45 @@
+#ifndef _KERN_VMSTATS_H_
+#define _KERN_VMSTATS_H_
+
+/*
+ * Indices of the VM statistics counters, shared with userland so that
+ * programs can make sense of what __vmstat() hands back. The names
+ * that go with them are in kern/vm/uw-vmstats.c.
+ */
+
+#define VMSTAT_TLB_FAULT              (0)
+#define VMSTAT_TLB_FAULT_FREE         (1)
+#define VMSTAT_TLB_FAULT_REPLACE      (2)
+#define VMSTAT_TLB_INVALIDATE         (3)
+#define VMSTAT_TLB_RELOAD             (4)
+#define VMSTAT_PAGE_FAULT_ZERO        (5)
+#define VMSTAT_PAGE_FAULT_DISK        (6)
+#define VMSTAT_ELF_FILE_READ          (7)
+#define VMSTAT_SWAP_FILE_READ         (8)
+#define VMSTAT_SWAP_FILE_WRITE        (9)
+#define VMSTAT_AS_SWITCH             (10)
+#define VMSTAT_ASID_ROLLOVER         (11)
+#define VMSTAT_MMAP_FILE_READ        (12)
+#define VMSTAT_MMAP_FILE_WRITE       (13)
+#define VMSTAT_ZERO_POOL_HIT         (14)
+#define VMSTAT_ZERO_POOL_MISS        (15)
+#define VMSTAT_SHOOTDOWN             (16)
+#define VMSTAT_SHOOTDOWN_PAGE        (17)
+#define VMSTAT_SHOOTDOWN_IPI         (18)
+#define VMSTAT_SHOOTDOWN_SKIP        (19)
+#define VMSTAT_SHOOTDOWN_USEC        (20)
+#define VMSTAT_TLB_PRELOAD           (21)
+#define VMSTAT_PAGE_PREFETCH         (22)
+#define VMSTAT_CLEAN_EVICT           (23)
+#define VMSTAT_PAGE_MERGE            (24)
+#define VMSTAT_ZSWAP_STORE           (25)
+#define VMSTAT_ZSWAP_REJECT          (26)
+#define VMSTAT_ZSWAP_HIT             (27)
+#define VMSTAT_ZSWAP_BYTES           (28)
+#define VMSTAT_ZSWAP_WRITEBACK       (29)
+#define VMSTAT_COMPACT               (30)
+#define VMSTAT_COMPACT_FAIL          (31)
+#define VMSTAT_PAGE_MIGRATE          (32)
+#define VMSTAT_COUNT                 (33)
+
+#endif /* _KERN_VMSTATS_H_ */
@@ -0,0 +1,66 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * File page cache.
+ *
+ * Pages of files mapped with mmap, and whole pages of read-only
+ * executable segments, are kept here, one frame per (vnode, page
+ * offset), and shared by every address space that maps them. The
+ * cache holds one reference to each frame and one to each vnode it
+ * has pages of; every mapping of a page holds another reference to
+ * the frame. To make room, pages only the cache still holds are
+ * dropped, and so are mapped ones that haven't been used lately,
+ * once they've been unmapped (vm_unmapfile). Either way, dirty pages
+ * are written back to their file first.
+ */
+
+#include <types.h>
+
+struct vnode;
+
+/* Set up the cache; called once from vm_bootstrap. */
+void pagecache_bootstrap(void);
+
+/*
+ * pagecache_get   - find the page of VN at OFFSET, reading it in if it
+ *                   isn't cached, and return its frame in *PADDRP with
+ *                   a reference taken for the caller. *READP says
+ *                   whether it had to be read, for the caller to count
+ *                   in whichever vmstat fits. Whatever lies past the
+ *                   end of the file reads as zeros.
+ *
+ * pagecache_dirty - note that the caller is about to write the page
+ *                   of VN at OFFSET, which it holds in frame PADDR.
+ *
+ * pagecache_put   - give back the reference to frame PADDR, the page
+ *                   of VN at OFFSET, from pagecache_get, writing the
+ *                   page to the file first if it's dirty. A page
+ *                   dropped by pagecache_invalidate isn't written.
+ *
+ * pagecache_sync  - write back every dirty page of VN, or of every
+ *                   file if VN is NULL.
+ *
+ * pagecache_invalidate - the LEN bytes of VN at OFFSET (everything
+ *                   from OFFSET on, if LEN is 0) have just changed
+ *                   under the cache. Their pages are dropped, so the
+ *                   next use reads them again. Mappings are undone
+ *                   if they can be without waiting; programs still
+ *                   running from or mapping a dropped page keep the
+ *                   old frame, which is never changed under them,
+ *                   and stores to it don't reach the file. Called by
+ *                   VOP_WRITE and VOP_TRUNCATE.
+ *
+ * pagecache_evict - drop one page, by a clock over the cache, to free
+ *                   its frame; see above. ENOMEM if there isn't one,
+ *                   or if the cache is busy. Never waits for a lock.
+ */
+int pagecache_get(struct vnode *vn, off_t offset, paddr_t *paddrp,
+		  bool *readp);
+void pagecache_dirty(struct vnode *vn, off_t offset, paddr_t paddr);
+int pagecache_put(struct vnode *vn, off_t offset, paddr_t paddr);
+int pagecache_sync(struct vnode *vn);
+void pagecache_invalidate(struct vnode *vn, off_t offset, off_t len);
+int pagecache_evict(void);
+
+#endif /* _PAGECACHE_H_ */
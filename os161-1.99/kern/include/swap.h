@@ -0,0 +1,42 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Backing store for evicted user pages.
+ *
+ * The swap area is the raw disk SWAP_DEVICE, cut into page-sized
+ * slots. Each slot carries a reference count so that a forked child
+ * can share its parent's swapped-out pages the same way it shares
+ * resident frames. Pages are kept compressed in memory while there's
+ * room (see zswap.h), and only go to the disk after that; without a
+ * disk, there are still slots to number compressed pages with.
+ */
+
+#include <types.h>
+
+#define SWAP_DEVICE  "lhd1raw:"
+
+/* Open the swap device, if there is one. */
+void swap_bootstrap(void);
+
+/*
+ * swap_out    - write the frame at PADDR to a fresh slot and return
+ *               the slot number in *SLOT. ENOSPC when swap is full.
+ *
+ * swap_write  - write the page at kernel address BUF to SLOT on disk,
+ *               for the compressed pool to make room.
+ *
+ * swap_in     - read slot SLOT into the frame at PADDR. The slot is
+ *               not released.
+ *
+ * swap_incref - take another reference to SLOT.
+ *
+ * swap_decref - drop a reference to SLOT, freeing it with the last.
+ */
+int swap_out(paddr_t paddr, int *slot);
+int swap_write(int slot, const void *buf);
+int swap_in(int slot, paddr_t paddr);
+void swap_incref(int slot);
+void swap_decref(int slot);
+
+#endif /* _SWAP_H_ */
@@ -82,6 +82,7 @@ struct lock {
 
 struct lock *lock_create(const char *name);
 void lock_acquire(struct lock *);
+bool lock_tryacquire(struct lock *);
 
 /*
  * Operations:
@@ -91,6 +92,9 @@ void lock_acquire(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
+ *    lock_tryacquire - Get the lock if nobody holds it and return true;
+ *                   otherwise return false at once. Never sleeps, so it
+ *                   may be called with spinlocks held.
  *
  * These operations must be atomic. You get to write them.
  */
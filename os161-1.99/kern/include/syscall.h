@@ -31,6 +31,7 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -70,6 +71,20 @@ int tf_copy(struct trapframe *src, struct trapframe *tf);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(char *progname, char **args, pid_t *retval);
 #endif
+#if OPT_A3
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(size_t len, int prot, off_t offset, userptr_t path,
+	     vaddr_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+int sys_madvise(vaddr_t addr, size_t len, int advice);
+int sys_mincore(vaddr_t addr, size_t len, userptr_t vec);
+int sys_mlock(vaddr_t addr, size_t len, bool lock);
+int sys_mprotect(vaddr_t addr, size_t len, int prot);
+int sys___vmstat(userptr_t counts, unsigned ncounts, int reset, int *retval);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, userptr_t rlp);
+int sys_sync(void);
+#endif
 
 #endif // UW
 
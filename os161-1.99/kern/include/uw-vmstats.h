@@ -12,7 +12,9 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions (except vmstats_print) whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines): _vmstats_init by acquiring
+ * stats_lock, _vmstats_inc by running with interrupts off, since the
+ * counters are kept per cpu.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally (except vmstats_print).
  *
@@ -23,20 +25,9 @@
 
 /* These are the different stats that get tracked.
  * See vmstats.c for strings corresponding to each stat.
+ * The indices live in <kern/vmstats.h> so that userland can use them.
  */
-
-/* DO NOT ADD OR CHANGE WITHOUT ALSO CHANGING vmstats.h */
-#define VMSTAT_TLB_FAULT              (0)
-#define VMSTAT_TLB_FAULT_FREE         (1)
-#define VMSTAT_TLB_FAULT_REPLACE      (2)
-#define VMSTAT_TLB_INVALIDATE         (3)
-#define VMSTAT_TLB_RELOAD             (4)
-#define VMSTAT_PAGE_FAULT_ZERO        (5)
-#define VMSTAT_PAGE_FAULT_DISK        (6)
-#define VMSTAT_ELF_FILE_READ          (7)
-#define VMSTAT_SWAP_FILE_READ         (8)
-#define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#include <kern/vmstats.h>
 
 /* ----------------------------------------------------------------------- */
 
@@ -49,10 +40,18 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
  *   vmstats_inc(VMSTAT_TLB_FAULT);
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
-void vmstats_inc(unsigned int index);    /* uses locking */
-void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
+void vmstats_inc(unsigned int index);    /* lock-free, per cpu */
+void _vmstats_inc(unsigned int index);   /* caller must have interrupts off */
+
+void vmstats_add(unsigned int index, unsigned int amount);   /* lock-free, per cpu */
+
+/* Copy the VMSTAT_COUNT counts since the last reset into COUNTS,
+ * summed over all cpus; with RESET, start counting from zero again.
+ * Increments racing with this land on one side or the other.
+ */
+void vmstats_snapshot(unsigned int *counts, bool reset);
 
 /* Print the statistics: assumes that at least vmstats_init has been called */
-void vmstats_print(void);                    /* Does NOT use locking */
+void vmstats_print(void);
 
 #endif /* VM_STATS_H */
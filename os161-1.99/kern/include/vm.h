@@ -55,6 +55,50 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate one frame for user memory, evicting if need be; 0 if none.
+ * With ZERO, the frame comes zero-filled, from the pool if possible.
+ */
+paddr_t getuserpage(bool zero);
+
+/*
+ * For the page cache, whose frames have no recorded mapping: find the
+ * mappings of page OFFSET of VN, in frame PADDR, in every address
+ * space. With UNMAP false, just make their next use go through
+ * vm_fault, so that the frame is seen to be used; with UNMAP true,
+ * take them all away, leaving the cache the only holder. False if one
+ * couldn't be got at without waiting, or is locked in memory, in which
+ * case nothing is taken. Never waits for a lock.
+ */
+struct vnode;
+bool vm_unmapfile(struct vnode *vn, off_t offset, paddr_t paddr, bool unmap);
+
+/*
+ * Fault-around. When a TLB miss has to go through vm_fault, also load
+ * the TLB with the neighbouring pages, up to this many either side,
+ * whose page table entries are ready to use. Returns the window in
+ * pages, first setting it to NPAGES (at most VM_FAULTAROUND_MAX) if
+ * that isn't negative. 0, the default, turns it off.
+ */
+#define VM_FAULTAROUND_MAX  8
+unsigned vm_faultaround(int npages);
+
+/*
+ * Same-page merging. A kernel thread folds user frames with identical
+ * contents into one frame shared copy-on-write. vm_mergerate returns
+ * how many pages it looks at a second, first setting that to NPAGES
+ * if that isn't negative; 0 stops it. vm_mergestats prints how many
+ * frames are shared and how many that saves.
+ */
+unsigned vm_mergerate(int npages);
+void vm_mergestats(void);
+
+/*
+ * Print each address space's resident set size, limit and fault
+ * counts (see as_rsslimit), and the limit new ones get.
+ */
+void vm_rssstats(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
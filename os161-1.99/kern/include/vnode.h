@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include "opt-A3.h"
 
 struct uio;
 struct stat;
@@ -248,14 +249,22 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
+#if OPT_A3
+#define VOP_WRITE(vn, uio)              (vnode_write(vn, uio))
+#else
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#endif
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#if OPT_A3
+#define VOP_TRUNCATE(vn, pos)           (vnode_truncate(vn, pos))
+#else
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#endif
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -274,6 +283,16 @@ struct vnode_ops {
  */
 void vnode_check(struct vnode *, const char *op);
 
+#if OPT_A3
+/*
+ * VOP_WRITE and VOP_TRUNCATE, which also drop whatever the page cache
+ * holds of the part of the file that changed, so that nothing maps
+ * the old contents from then on (see pagecache_invalidate).
+ */
+int vnode_write(struct vnode *vn, struct uio *uio);
+int vnode_truncate(struct vnode *vn, off_t len);
+#endif
+
 /*
  * Reference count manipulation (handled above filesystem level)
  */
@@ -0,0 +1,42 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed swap pool.
+ *
+ * Evicted pages are compressed (a small LZ77 coder in the manner of
+ * LZRW1) into a pool of frames kept aside for the purpose, before
+ * they ever go to disk, and fetched back from there on a fault
+ * without any I/O. Pages are known by the swap slot they were given,
+ * so the pool is invisible above swap.c. Pages that won't shrink to
+ * half a page go straight to disk; pages filled with one repeated
+ * word take no pool memory at all. When the pool is full, the
+ * oldest page of the size needed is written out to its slot.
+ *
+ * A compressed page stays in the pool until its slot is freed, so a
+ * page that's swapped in and evicted again unchanged costs nothing.
+ */
+
+#include <types.h>
+
+/* Set up for swap slots 0 to NSLOTS-1; called from swap_bootstrap. */
+void zswap_bootstrap(unsigned nslots);
+
+/*
+ * zswap_store - keep a compressed copy of the frame at PADDR for
+ *               SLOT, which must have none yet. E2BIG if it doesn't
+ *               compress well, ENOSPC if there's no room for it.
+ *
+ * zswap_load  - fill the frame at PADDR from SLOT's compressed copy.
+ *               False if it has none; it's on disk then.
+ *
+ * zswap_drop  - forget SLOT's compressed copy, if any.
+ *
+ * These may sleep. zswap_store may write to the swap disk, so it's
+ * for the evictor only; the other two never do I/O.
+ */
+int zswap_store(int slot, paddr_t paddr);
+bool zswap_load(int slot, paddr_t paddr);
+void zswap_drop(int slot);
+
+#endif /* _ZSWAP_H_ */
@@ -31,6 +31,7 @@
  * Main.
  */
 
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/reboot.h>
@@ -49,6 +50,9 @@
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#if OPT_A3
+#include <uw-vmstats.h>
+#endif
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -146,6 +150,10 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+
+#if OPT_A3
+	vmstats_print();
+#endif
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
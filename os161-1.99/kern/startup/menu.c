@@ -28,6 +28,7 @@
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/reboot.h>
@@ -43,6 +44,11 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#if OPT_A3
+#include <addrspace.h>
+#include <coremap.h>
+#include <uw-vmstats.h>
+#endif
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -427,6 +433,162 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_A3
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
+/*
+ * Command to print the VM statistics counted since boot or since the
+ * last reset, and optionally start counting over.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	unsigned int counts[VMSTAT_COUNT];
+
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "reset"))) {
+		kprintf("Usage: vm [reset]\n");
+		return EINVAL;
+	}
+
+	vmstats_print();
+	if (nargs == 2) {
+		vmstats_snapshot(counts, true);
+		kprintf("vm: counters reset\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Command to show or set the stack limit, in pages, that new programs
+ * get. Running processes and their forks keep the one they started
+ * with.
+ */
+static
+int
+cmd_stacklimit(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs > 2) {
+		kprintf("Usage: stk [pages]\n");
+		return EINVAL;
+	}
+
+	npages = 0;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+		if (npages <= 0) {
+			kprintf("stk: limit must be at least one page\n");
+			return EINVAL;
+		}
+	}
+
+	kprintf("Stack limit: %lu pages\n",
+		(unsigned long) as_stacklimit(npages));
+	return 0;
+}
+
+/*
+ * Command to show or set the fault-around window: how many resident
+ * pages either side of a faulting page go into the TLB with it.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs > 2) {
+		kprintf("Usage: fa [pages]\n");
+		return EINVAL;
+	}
+
+	npages = -1;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+		if (npages < 0 || npages > VM_FAULTAROUND_MAX) {
+			kprintf("fa: window must be 0 to %d pages\n",
+				VM_FAULTAROUND_MAX);
+			return EINVAL;
+		}
+	}
+
+	kprintf("Fault-around: %u pages either side\n",
+		vm_faultaround(npages));
+	return 0;
+}
+
+/*
+ * Command to show same-page merging, and optionally set how many
+ * pages a second it looks at.
+ */
+static
+int
+cmd_merge(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs > 2) {
+		kprintf("Usage: merge [pages]\n");
+		return EINVAL;
+	}
+
+	npages = -1;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+		if (npages < 0) {
+			kprintf("merge: rate can't be negative\n");
+			return EINVAL;
+		}
+	}
+
+	vm_mergerate(npages);
+	vm_mergestats();
+	return 0;
+}
+
+/*
+ * Command to show each address space's resident set, and optionally
+ * set the limit programs started from here on get (0 for none).
+ */
+static
+int
+cmd_rsslimit(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs > 2) {
+		kprintf("Usage: rss [pages]\n");
+		return EINVAL;
+	}
+
+	npages = -1;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+		if (npages < 0) {
+			kprintf("rss: limit can't be negative\n");
+			return EINVAL;
+		}
+	}
+
+	(void)as_rssdefault(npages);
+	vm_rssstats();
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -467,6 +629,12 @@ static const char *opsmenu[] = {
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
 	"[dth]     Enable DB_THREADS         ",
+#if OPT_A3
+	"[stk]     Show/set stack limit      ",
+	"[fa]      Show/set fault-around     ",
+	"[merge]   Show/set page merging     ",
+	"[rss]     Show/set resident limit   ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -537,6 +705,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_A3
+	"[cm] Coremap stats                  ",
+	"[vm] VM stats [reset]               ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -578,6 +750,12 @@ static struct {
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
 	{ "dth",	cmd_dth },
+#if OPT_A3
+	{ "stk",	cmd_stacklimit },
+	{ "fa",		cmd_faultaround },
+	{ "merge",	cmd_merge },
+	{ "rss",	cmd_rsslimit },
+#endif
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -594,6 +772,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_A3
+	{ "cm",         cmd_coremapstats },
+	{ "vm",         cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -77,6 +77,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if !OPT_A3
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -147,6 +148,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#endif /* !OPT_A3 */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -264,6 +266,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	/*
 	 * Now actually load each segment.
 	 */
+#if OPT_A3
+	/*
+	 * (Or rather, tell the address space where each one lives in
+	 * the file; vm_fault reads pages in as they are touched.)
+	 */
+#endif
 
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
@@ -291,9 +299,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_A3
+		result = as_define_source(as, v, ph.p_offset, ph.p_vaddr,
+					  ph.p_memsz, ph.p_filesz);
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
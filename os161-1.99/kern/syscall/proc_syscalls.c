@@ -211,12 +211,15 @@ sys_fork(struct trapframe *tf, pid_t *retval) {
   }
 
   // Create and copy address space
-  spinlock_acquire(&child->p_lock);
-  error = as_copy(curproc_getas(), &child->p_addrspace);
+  // (as_copy may sleep, so not under p_lock; nobody can see the child yet)
+  struct addrspace *childAS;
+  error = as_copy(curproc_getas(), &childAS);
   if (error) {
     return ENOMEM;
     //panic("fork: as_copy returned an error");
   }
+  spinlock_acquire(&child->p_lock);
+  child->p_addrspace = childAS;
   spinlock_release(&child->p_lock);
 
   // Create thread for child process
@@ -303,6 +306,13 @@ sys_execv(char *progname, char **args, pid_t *retval) {
     vfs_close(v);
     return ENOMEM;
   }
+#if OPT_A3
+  // exec keeps the resident set limit, like any other rlimit; the
+  // default from as_create is only for programs the kernel starts
+  if (oldAS != NULL) {
+    (void)as_rsslimit(as, as_rsslimit(oldAS, -1));
+  }
+#endif
 
   /* Switch to it and activate it. */
   curproc_setas(as);
@@ -0,0 +1,327 @@
+/*
+ * Memory management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <limits.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include <uw-vmstats.h>
+
+/*
+ * sbrk: move the break by AMOUNT bytes and return where it was. The
+ * libc malloc only ever asks for page-aligned amounts, but nothing
+ * here depends on that.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: sbrk(%ld)\n", (long)amount);
+
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * mmap: map LEN bytes of the file at PATH, starting at OFFSET, and
+ * return the address. There are no file descriptors to map by, so
+ * the file is named instead. Mappings are always shared: stores reach
+ * the file when the mapping goes away (or on sync), and every process
+ * mapping the file sees the same pages.
+ */
+int
+sys_mmap(size_t len, int prot, off_t offset, userptr_t path, vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct vnode *vn;
+	char *kpath;
+	int result;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
+	}
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: mmap(%lu, %d, %lld, %s)\n",
+	      (unsigned long)len, prot, (long long)offset, kpath);
+
+	result = vfs_open(kpath, (prot & PROT_WRITE) ? O_RDWR : O_RDONLY, 0,
+			  &vn);
+	kfree(kpath);
+	if (result) {
+		return result;
+	}
+
+	// can this kind of file be paged through the cache at all?
+	result = VOP_MMAP(vn);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+
+	result = as_mmap(as, vn, offset, len, (prot & PROT_WRITE) != 0, retval);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	return 0;
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: munmap(0x%lx, %lu)\n",
+	      (unsigned long)addr, (unsigned long)len);
+
+	return as_munmap(as, addr, len);
+}
+
+/*
+ * mprotect: change what may be done to the pages at ADDR; see
+ * as_mprotect.
+ */
+int
+sys_mprotect(vaddr_t addr, size_t len, int prot)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: mprotect(0x%lx, %lu, %d)\n",
+	      (unsigned long)addr, (unsigned long)len, prot);
+
+	return as_mprotect(as, addr, len, prot);
+}
+
+/*
+ * madvise: take advice about how the pages at ADDR will be used; see
+ * as_madvise.
+ */
+int
+sys_madvise(vaddr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: madvise(0x%lx, %lu, %d)\n",
+	      (unsigned long)addr, (unsigned long)len, advice);
+
+	return as_madvise(as, addr, len, advice);
+}
+
+/*
+ * mincore: one byte per page at ADDR into VEC, 1 if the page is in
+ * memory. Done a chunk at a time, since copyout can fault and the
+ * address space is locked while we look.
+ */
+int
+sys_mincore(vaddr_t addr, size_t len, userptr_t vec)
+{
+	unsigned char kvec[64];
+	struct addrspace *as;
+	size_t npages, n;
+	int result;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	if (addr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (len > USERSTACK || addr > USERSTACK - len) {
+		return ENOMEM;
+	}
+
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	while (npages > 0) {
+		n = npages < sizeof(kvec) ? npages : sizeof(kvec);
+		result = as_mincore(as, addr, n, kvec);
+		if (result) {
+			return result;
+		}
+		result = copyout(kvec, vec, n);
+		if (result) {
+			return result;
+		}
+		addr += n * PAGE_SIZE;
+		vec = (userptr_t)((vaddr_t)vec + n);
+		npages -= n;
+	}
+	return 0;
+}
+
+/*
+ * mlock/munlock (LOCK false): keep the pages at ADDR in memory, or let
+ * them go again.
+ */
+int
+sys_mlock(vaddr_t addr, size_t len, bool lock)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: %s(0x%lx, %lu)\n",
+	      lock ? "mlock" : "munlock",
+	      (unsigned long)addr, (unsigned long)len);
+
+	return as_mlock(as, addr, len, lock);
+}
+
+/*
+ * __vmstat: copy out the first NCOUNTS of the VM statistics counters
+ * (indexed as in kern/vmstats.h) and return how many there are, so a
+ * caller can tell whether it saw them all. If RESET is set, counting
+ * starts over from zero afterwards. COUNTS may be NULL with NCOUNTS 0
+ * to just ask for the size.
+ */
+int
+sys___vmstat(userptr_t counts, unsigned ncounts, int reset, int *retval)
+{
+	unsigned int snap[VMSTAT_COUNT];
+	int result;
+
+	vmstats_snapshot(snap, reset != 0);
+
+	if (ncounts > VMSTAT_COUNT) {
+		ncounts = VMSTAT_COUNT;
+	}
+	if (ncounts > 0) {
+		result = copyout(snap, counts, ncounts * sizeof(snap[0]));
+		if (result) {
+			return result;
+		}
+	}
+	*retval = VMSTAT_COUNT;
+	return 0;
+}
+
+/*
+ * sync: get stores to mapped files out to their files without
+ * unmapping them, along with whatever the filesystems are holding.
+ */
+int
+sys_sync(void)
+{
+	DEBUG(DB_SYSCALL, "Syscall: sync()\n");
+
+	return vfs_sync();
+}
+
+/*
+ * getrlimit/setrlimit: only RLIMIT_RSS, the resident set limit (see
+ * as_rsslimit), in bytes. There's no separate hard limit; the limit
+ * can always be raised again, so rlim_max reads back as infinite.
+ */
+int
+sys_getrlimit(int resource, userptr_t rlp)
+{
+	struct addrspace *as;
+	struct rlimit rl;
+	size_t npages;
+
+	if (resource != RLIMIT_RSS) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	npages = as_rsslimit(as, -1);
+	rl.rlim_cur = npages == 0 ? RLIM_INFINITY :
+		(rlim_t)npages * PAGE_SIZE;
+	rl.rlim_max = RLIM_INFINITY;
+	return copyout(&rl, rlp, sizeof(rl));
+}
+
+int
+sys_setrlimit(int resource, userptr_t rlp)
+{
+	struct addrspace *as;
+	struct rlimit rl;
+	rlim_t npages;
+	int result;
+
+	if (resource != RLIMIT_RSS) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	result = copyin(rlp, &rl, sizeof(rl));
+	if (result) {
+		return result;
+	}
+	if (rl.rlim_cur > rl.rlim_max) {
+		return EINVAL;
+	}
+
+	DEBUG(DB_SYSCALL, "Syscall: setrlimit(RLIMIT_RSS, %llu)\n",
+	      (unsigned long long)rl.rlim_cur);
+
+	// 0 pages means no limit to as_rsslimit
+	npages = 0;
+	if (rl.rlim_cur != RLIM_INFINITY) {
+		npages = rl.rlim_cur / PAGE_SIZE;
+		if (npages == 0) {
+			return EINVAL;
+		}
+		if (npages > USERSPACETOP / PAGE_SIZE) {
+			// more than could ever be resident
+			npages = 0;
+		}
+	}
+	(void)as_rsslimit(as, (int)npages);
+	return 0;
+}
@@ -207,6 +207,22 @@ lock_acquire(struct lock *lock)
 	spinlock_release(&lock->lk_spinlock);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool got = false;
+
+	KASSERT(lock != NULL);
+	spinlock_acquire(&lock->lk_spinlock);
+	if (lock->lk_holder == NULL) {
+		lock->lk_holder = curthread;
+		lock->locked = true;
+		got = true;
+	}
+	spinlock_release(&lock->lk_spinlock);
+	return got;
+}
+
 void
 lock_release(struct lock *lock)
 {
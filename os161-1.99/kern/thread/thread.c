@@ -34,6 +34,7 @@
 #define THREADINLINE
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -51,6 +52,9 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#if OPT_A3
+#include <coremap.h>
+#endif
 
 #include "opt-synchprobs.h"
 
@@ -639,7 +643,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_A3
+			/*
+			 * Zero a frame for the VM system instead, if it
+			 * wants one. It's one page at a time, so we look
+			 * at the run queue again soon enough.
+			 */
+			if (!coremap_zerofill()) {
+				cpu_idle();
+			}
+#else
 			cpu_idle();
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1144,20 +1159,30 @@ ipi_broadcast(int code)
 	}
 }
 
+/*
+ * Queue N mappings for TARGET, and send it one IPI for all of them.
+ */
+static
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_many(struct cpu *target,
+		      const struct tlbshootdown *mappings, unsigned n)
 {
-	int n;
+	unsigned i;
+	int k;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	for (i=0; i<n; i++) {
+		k = target->c_numshootdown;
+		if (k == TLBSHOOTDOWN_ALL) {
+			break;
+		}
+		if (k == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+			break;
+		}
+		target->c_shootdown[k] = mappings[i];
+		target->c_numshootdown = k+1;
 	}
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
@@ -1166,6 +1191,36 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_many(target, mapping, 1);
+}
+
+unsigned
+ipi_tlbshootdown_cpus(uint32_t cpus, const struct tlbshootdown *mappings,
+		      unsigned n, unsigned *skipped)
+{
+	unsigned i, sent;
+	struct cpu *c;
+
+	sent = 0;
+	*skipped = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		if ((cpus & (1U << c->c_number)) == 0) {
+			(*skipped)++;
+			continue;
+		}
+		ipi_tlbshootdown_many(c, mappings, n);
+		sent++;
+	}
+	return sent;
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -34,6 +34,7 @@
 
 #define VFSINLINE
 
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -43,6 +44,9 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#if OPT_A3
+#include <pagecache.h>
+#endif
 
 /*
  * Structure for a single named device.
@@ -146,13 +150,24 @@ vfs_biglock_do_i_hold(void)
 }
 
 /*
- * Global sync function - call FSOP_SYNC on all devices.
+ * Global sync function - call FSOP_SYNC on all devices. Fails only if
+ * writing back mmapped pages did; the devices are synced regardless.
  */
 int
 vfs_sync(void)
 {
 	struct knowndev *dev;
 	unsigned i, num;
+	int result = 0;
+
+#if OPT_A3
+	/* Get stores to mmapped files out first; not under the biglock */
+	result = pagecache_sync(NULL);
+	if (result) {
+		kprintf("vfs: Warning: writing back mapped pages failed: "
+			"%s\n", strerror(result));
+	}
+#endif
 
 	vfs_biglock_acquire();
 
@@ -166,7 +181,7 @@ vfs_sync(void)
 
 	vfs_biglock_release();
 
-	return 0;
+	return result;
 }
 
 /*
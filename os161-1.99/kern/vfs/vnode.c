@@ -30,12 +30,17 @@
 /*
  * Basic vnode support functions.
  */
+#include "opt-A3.h"
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
+#include <uio.h>
 #include <vfs.h>
 #include <vnode.h>
+#if OPT_A3
+#include <pagecache.h>
+#endif
 
 /*
  * Initialize an abstract vnode.
@@ -225,3 +230,38 @@ vnode_check(struct vnode *v, const char *opstr)
 
 	vfs_biglock_release();
 }
+
+#if OPT_A3
+/*
+ * Write, then forget the cached pages of whatever got written, even
+ * on a short write.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	off_t start = uio->uio_offset;
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	if (uio->uio_offset > start) {
+		pagecache_invalidate(vn, start, uio->uio_offset - start);
+	}
+	return result;
+}
+
+/*
+ * Truncate (or extend), then forget the cached pages from the new end
+ * on.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t len)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, len);
+	if (result == 0) {
+		pagecache_invalidate(vn, len, 0);
+	}
+	return result;
+}
+#endif
@@ -0,0 +1,1139 @@
+/*
+ * Buddy-system physical frame manager.
+ *
+ * Frame i (counting from cm_base) is free and heads a block of
+ * 2^k frames iff cm_frames[i].cf_state == (CF_FREE | CF_HEAD | k). An
+ * allocated block has CF_HEAD and its order but not CF_FREE. Frames in
+ * the middle of a block have state 0. Owner and reference count are
+ * only meaningful in the head frame of an allocated block.
+ *
+ * The buddy of the block of order k at index i is the block at
+ * i ^ (1 << k); blocks are always aligned to their own size relative
+ * to cm_base, so this is well defined.
+ *
+ * A user frame that belongs to exactly one page of one address space
+ * also records which (cf_as, cf_vaddr); those are the frames the
+ * clock may hand out for eviction. Sharing a frame (coremap_incref)
+ * forgets the mapping until the VM system claims it again.
+ *
+ * A user frame marked CF_CLEAN still matches a copy of its contents
+ * elsewhere - the swap slot cf_slot, or if that's -1 wherever the page
+ * first came from - so evicting it needs no write.
+ *
+ * Compaction opens up a block for a large allocation by moving the
+ * user pages out of it. While that goes on, the free and vacated parts
+ * of the block are held as allocated blocks of their own, marked
+ * CF_ISOLATED, so nobody else gets them; at the end they are either
+ * joined into one or released.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <uw-vmstats.h>
+#include <platform/maxcpus.h>
+
+#define CF_ORDER  0x1f		/* order of the block headed here */
+#define CF_HEAD   0x40		/* first frame of a block */
+#define CF_FREE   0x80		/* block is on a free list */
+
+/* cf_flags */
+#define CF_REF    0x1		/* used since the clock last came by */
+#define CF_BUSY   0x2		/* being evicted; hands off */
+#define CF_CLEAN  0x4		/* unwritten since it was filled */
+#define CF_ISOLATED 0x8		/* held for compaction */
+
+struct cm_frame {
+	uint8_t cf_state;	/* CF_* bits and order */
+	uint8_t cf_owner;	/* CM_* owner tag */
+	uint16_t cf_refcount;	/* references to an allocated block */
+	uint32_t cf_flags;	/* CF_REF, CF_BUSY, CF_CLEAN, CF_ISOLATED */
+	struct addrspace *cf_as;	/* sole mapping of a user frame */
+	vaddr_t cf_vaddr;
+	int cf_slot;		/* swap slot a clean frame matches, or -1 */
+};
+
+/* Free list links, stored in the first bytes of each free block. */
+struct cm_freeblock {
+	struct cm_freeblock *fb_next;
+	struct cm_freeblock *fb_prev;
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct cm_frame *cm_frames;	/* indexed by frame number */
+static paddr_t cm_base;			/* physical address of frame 0 */
+static unsigned cm_nframes;		/* number of frames we manage */
+static unsigned cm_owned[CM_NOWNERS];	/* frames held by each owner */
+static bool cm_loaded = false;
+
+static struct cm_freeblock *cm_freelist[CM_MAXORDER + 1];
+static unsigned cm_nfree[CM_MAXORDER + 1];
+
+static unsigned cm_clockhand;		/* next frame the clock looks at */
+
+/* Frames zeroed by idle cpus, all owned by CM_ZERO. */
+#define CM_ZEROMAX  64
+static paddr_t cm_zeropool[CM_ZEROMAX];
+static unsigned cm_nzero;
+static unsigned cm_zerowater;		/* how full idle cpus keep it */
+#define CM_ZEROCHUNK  512		/* bytes cleared between interrupt checks */
+
+/*
+ * Per-cpu frame caches. Single frames are allocated from, and freed
+ * to, a small stack on the cpu doing it, which only that cpu touches
+ * and only at splhigh, so most of them never take coremap_lock. An
+ * empty cache refills, and a full one drains, CM_PCPU_BATCH frames in
+ * one trip to the free lists. As far as the buddy allocator knows,
+ * cached frames are allocated to CM_CACHED.
+ *
+ * Owner changes made without the lock are counted in pc_owned instead
+ * of cm_owned; the true count for an owner is the sum of both.
+ */
+#define CM_PCPU_MAX    16
+#define CM_PCPU_BATCH  8
+
+struct cm_pcpu {
+	paddr_t pc_frames[CM_PCPU_MAX];
+	unsigned pc_count;
+	int pc_owned[CM_NOWNERS];
+	unsigned pc_hits;	/* allocations served from the cache */
+	unsigned pc_misses;	/* allocations that had to refill it */
+	unsigned pc_frees;	/* frees into the cache */
+	unsigned pc_drains;	/* frees that had to drain it */
+};
+
+static struct cm_pcpu cm_pcpu[MAXCPUS];
+
+static
+struct cm_freeblock *
+cm_block(unsigned index)
+{
+	return (struct cm_freeblock *)
+		PADDR_TO_KVADDR(cm_base + index * PAGE_SIZE);
+}
+
+static
+unsigned
+cm_index(struct cm_freeblock *fb)
+{
+	return ((vaddr_t)fb - PADDR_TO_KVADDR(cm_base)) / PAGE_SIZE;
+}
+
+/*
+ * Frame number of the allocated block starting at PADDR.
+ */
+static
+unsigned
+cm_headindex(paddr_t paddr)
+{
+	unsigned index;
+
+	KASSERT(cm_loaded);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(paddr >= cm_base);
+
+	index = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(index < cm_nframes);
+	KASSERT((cm_frames[index].cf_state & (CF_HEAD | CF_FREE)) == CF_HEAD);
+	return index;
+}
+
+/*
+ * Put the block at INDEX on the free list for ORDER.
+ */
+static
+void
+cm_push(unsigned index, unsigned order)
+{
+	struct cm_freeblock *fb = cm_block(index);
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	fb->fb_prev = NULL;
+	fb->fb_next = cm_freelist[order];
+	if (fb->fb_next != NULL) {
+		fb->fb_next->fb_prev = fb;
+	}
+	cm_freelist[order] = fb;
+	cm_nfree[order]++;
+
+	cm_frames[index].cf_state = CF_FREE | CF_HEAD | order;
+	cm_frames[index].cf_owner = CM_FREE;
+	cm_frames[index].cf_refcount = 0;
+}
+
+/*
+ * Take the block at INDEX off the free list for ORDER.
+ */
+static
+void
+cm_unlink(unsigned index, unsigned order)
+{
+	struct cm_freeblock *fb = cm_block(index);
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cm_frames[index].cf_state == (CF_FREE | CF_HEAD | order));
+
+	if (fb->fb_prev != NULL) {
+		fb->fb_prev->fb_next = fb->fb_next;
+	} else {
+		cm_freelist[order] = fb->fb_next;
+	}
+	if (fb->fb_next != NULL) {
+		fb->fb_next->fb_prev = fb->fb_prev;
+	}
+	cm_nfree[order]--;
+
+	cm_frames[index].cf_state = 0;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned i, order, total;
+
+	ram_getsize(&lo, &hi);
+
+	/* the frame array lives at the bottom of what's left */
+	total = (hi - lo) / PAGE_SIZE;
+	cm_frames = (struct cm_frame *)PADDR_TO_KVADDR(lo);
+	lo = ROUNDUP(lo + total * sizeof(struct cm_frame), PAGE_SIZE);
+
+	cm_base = lo;
+	cm_nframes = (hi - lo) / PAGE_SIZE;
+	bzero(cm_frames, cm_nframes * sizeof(struct cm_frame));
+
+	/* carve memory into the largest aligned blocks that fit */
+	spinlock_acquire(&coremap_lock);
+	i = 0;
+	while (i < cm_nframes) {
+		order = CM_MAXORDER;
+		while ((i & ((1U << order) - 1)) != 0 ||
+		       i + (1U << order) > cm_nframes) {
+			order--;
+		}
+		cm_push(i, order);
+		cm_owned[CM_FREE] += 1U << order;
+		i += 1U << order;
+	}
+
+	/* don't sit on more than a thirty-second of memory */
+	cm_zerowater = cm_nframes / 32;
+	if (cm_zerowater > CM_ZEROMAX) {
+		cm_zerowater = CM_ZEROMAX;
+	}
+	cm_loaded = true;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_ready(void)
+{
+	return cm_loaded;
+}
+
+static void cm_release(unsigned index);
+
+/*
+ * Order of the smallest block of at least NPAGES frames; more than
+ * CM_MAXORDER if there's no such thing.
+ */
+static
+unsigned
+cm_order(unsigned long npages)
+{
+	unsigned order = 0;
+
+	while (order <= CM_MAXORDER && (1UL << order) < npages) {
+		order++;
+	}
+	return order;
+}
+
+/*
+ * Allocate a block of 2^ORDER frames for OWNER from the free lists.
+ * Returns false if none is big enough.
+ */
+static
+bool
+cm_take(unsigned order, int owner, unsigned *indexp)
+{
+	unsigned k, index;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	/* smallest non-empty list that is big enough */
+	for (k = order; k <= CM_MAXORDER; k++) {
+		if (cm_freelist[k] != NULL) {
+			break;
+		}
+	}
+	if (k > CM_MAXORDER) {
+		return false;
+	}
+
+	index = cm_index(cm_freelist[k]);
+	cm_unlink(index, k);
+
+	/* split, returning the upper halves to the free lists */
+	while (k > order) {
+		k--;
+		cm_push(index + (1U << k), k);
+	}
+
+	cm_frames[index].cf_state = CF_HEAD | order;
+	cm_frames[index].cf_owner = owner;
+	cm_frames[index].cf_refcount = 1;
+	cm_frames[index].cf_flags = 0;
+	cm_frames[index].cf_as = NULL;
+	cm_frames[index].cf_vaddr = 0;
+	cm_owned[CM_FREE] -= 1U << order;
+	cm_owned[owner] += 1U << order;
+
+	*indexp = index;
+	return true;
+}
+
+/*
+ * Refill this cpu's empty cache PC from the free lists, as far as they
+ * go.
+ */
+static
+void
+cm_cache_refill(struct cm_pcpu *pc)
+{
+	unsigned index;
+
+	KASSERT(pc->pc_count == 0);
+
+	spinlock_acquire(&coremap_lock);
+	while (pc->pc_count < CM_PCPU_BATCH && cm_take(0, CM_CACHED, &index)) {
+		pc->pc_frames[pc->pc_count++] = cm_base + index * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Give the NFRAMES frames at the bottom of this cpu's cache PC, the
+ * ones freed longest ago, back to the free lists. Called with
+ * coremap_lock held.
+ */
+static
+void
+cm_cache_drain(struct cm_pcpu *pc, unsigned nframes)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(nframes <= pc->pc_count);
+
+	for (i = 0; i < nframes; i++) {
+		cm_release(cm_headindex(pc->pc_frames[i]));
+	}
+	for (i = nframes; i < pc->pc_count; i++) {
+		pc->pc_frames[i - nframes] = pc->pc_frames[i];
+	}
+	pc->pc_count -= nframes;
+}
+
+/*
+ * One frame for OWNER from this cpu's cache, or 0 if even a refill
+ * can't find one.
+ */
+static
+paddr_t
+cm_cache_get(int owner)
+{
+	struct cm_pcpu *pc;
+	paddr_t paddr;
+	int spl;
+
+	spl = splhigh();
+	pc = &cm_pcpu[curcpu->c_number];
+	if (pc->pc_count == 0) {
+		pc->pc_misses++;
+		cm_cache_refill(pc);
+		if (pc->pc_count == 0) {
+			splx(spl);
+			return 0;
+		}
+	} else {
+		pc->pc_hits++;
+	}
+	paddr = pc->pc_frames[--pc->pc_count];
+	cm_frames[(paddr - cm_base) / PAGE_SIZE].cf_owner = owner;
+	pc->pc_owned[CM_CACHED]--;
+	pc->pc_owned[owner]++;
+	splx(spl);
+	return paddr;
+}
+
+/*
+ * Put the single allocated frame at INDEX into this cpu's cache. The
+ * caller has made sure the clock won't pick it (cf_as is NULL).
+ */
+static
+void
+cm_cache_put(unsigned index)
+{
+	struct cm_frame *cf = &cm_frames[index];
+	struct cm_pcpu *pc;
+	int spl;
+
+	KASSERT(cf->cf_as == NULL);
+	KASSERT((cf->cf_state & CF_ORDER) == 0);
+
+	spl = splhigh();
+	pc = &cm_pcpu[curcpu->c_number];
+	if (pc->pc_count == CM_PCPU_MAX) {
+		pc->pc_drains++;
+		spinlock_acquire(&coremap_lock);
+		cm_cache_drain(pc, CM_PCPU_BATCH);
+		spinlock_release(&coremap_lock);
+	}
+	pc->pc_frees++;
+	pc->pc_owned[cf->cf_owner]--;
+	pc->pc_owned[CM_CACHED]++;
+	cf->cf_owner = CM_CACHED;
+	cf->cf_refcount = 1;
+	cf->cf_flags = 0;
+	pc->pc_frames[pc->pc_count++] = cm_base + index * PAGE_SIZE;
+	splx(spl);
+}
+
+/*
+ * Give back the frames that are free but not on the free lists, as
+ * far as we can: the zero pool, and this cpu's cache. Other cpus'
+ * caches are theirs alone; they hold at most CM_PCPU_MAX frames each.
+ */
+static
+void
+cm_flush(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	/* memory is tight; the zero pool is a luxury */
+	while (cm_nzero > 0) {
+		cm_release(cm_headindex(cm_zeropool[--cm_nzero]));
+	}
+	/* and our cache may hold a buddy we need (splhigh here) */
+	cm_cache_drain(&cm_pcpu[curcpu->c_number],
+		       cm_pcpu[curcpu->c_number].pc_count);
+}
+
+paddr_t
+coremap_alloc(unsigned long npages, int owner)
+{
+	unsigned order, index;
+	paddr_t paddr;
+	bool ok;
+
+	KASSERT(cm_loaded);
+	KASSERT(owner > CM_FREE && owner < CM_ZERO);
+
+	if (npages == 1) {
+		paddr = cm_cache_get(owner);
+		if (paddr != 0) {
+			return paddr;
+		}
+	}
+
+	order = cm_order(npages);
+	if (order > CM_MAXORDER) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	ok = cm_take(order, owner, &index);
+	if (!ok) {
+		cm_flush();
+		ok = cm_take(order, owner, &index);
+	}
+	spinlock_release(&coremap_lock);
+
+	return ok ? cm_base + index * PAGE_SIZE : 0;
+}
+
+paddr_t
+coremap_alloc_zeroed(int owner)
+{
+	unsigned index;
+	paddr_t paddr;
+
+	KASSERT(cm_loaded);
+	KASSERT(owner > CM_FREE && owner < CM_ZERO);
+
+	/* don't bother with the lock if the pool is plainly empty */
+	if (cm_nzero > 0) {
+		spinlock_acquire(&coremap_lock);
+		if (cm_nzero > 0) {
+			paddr = cm_zeropool[--cm_nzero];
+			index = cm_headindex(paddr);
+			KASSERT(cm_frames[index].cf_owner == CM_ZERO);
+			cm_frames[index].cf_owner = owner;
+			cm_owned[CM_ZERO]--;
+			cm_owned[owner]++;
+			spinlock_release(&coremap_lock);
+			vmstats_inc(VMSTAT_ZERO_POOL_HIT);
+			return paddr;
+		}
+		spinlock_release(&coremap_lock);
+	}
+
+	paddr = coremap_alloc(1, owner);
+	if (paddr != 0) {
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+		vmstats_inc(VMSTAT_ZERO_POOL_MISS);
+	}
+	return paddr;
+}
+
+bool
+coremap_zerofill(void)
+{
+	unsigned index, off;
+	paddr_t paddr;
+
+	if (!cm_loaded) {
+		return false;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (cm_nzero >= cm_zerowater || !cm_take(0, CM_ZERO, &index)) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	spinlock_release(&coremap_lock);
+
+	/*
+	 * The frame is ours (CM_ZERO) and nothing else can see it, but
+	 * the idle loop runs at splhigh. Clear it a chunk at a time and
+	 * open an interrupt window between chunks, as cpu_idle does, so
+	 * a wakeup or the clock isn't held off for the whole page.
+	 */
+	paddr = cm_base + index * PAGE_SIZE;
+	for (off = 0; off < PAGE_SIZE; off += CM_ZEROCHUNK) {
+		bzero((void *)(PADDR_TO_KVADDR(paddr) + off), CM_ZEROCHUNK);
+		cpu_irqon();
+		cpu_irqoff();
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (cm_nzero < cm_zerowater) {
+		cm_zeropool[cm_nzero++] = paddr;
+	} else {
+		/* another cpu beat us to it */
+		cm_release(index);
+	}
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+/*
+ * Return the allocated block at INDEX to the free lists, merging it
+ * with its buddies.
+ */
+static
+void
+cm_release(unsigned index)
+{
+	unsigned order, buddy;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	order = cm_frames[index].cf_state & CF_ORDER;
+	cm_owned[cm_frames[index].cf_owner] -= 1U << order;
+	cm_owned[CM_FREE] += 1U << order;
+	cm_frames[index].cf_state = 0;
+	cm_frames[index].cf_flags = 0;
+	cm_frames[index].cf_as = NULL;
+
+	/* merge with the buddy for as long as it is free and whole */
+	while (order < CM_MAXORDER) {
+		buddy = index ^ (1U << order);
+		if (buddy >= cm_nframes ||
+		    cm_frames[buddy].cf_state != (CF_FREE | CF_HEAD | order)) {
+			break;
+		}
+		cm_unlink(buddy, order);
+		if (buddy < index) {
+			index = buddy;
+		}
+		order++;
+	}
+	cm_push(index, order);
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned index;
+
+	KASSERT(cm_loaded);
+
+	if (paddr < cm_base) {
+		/* stolen before coremap_bootstrap; it stays leaked */
+		return;
+	}
+
+	index = cm_headindex(paddr);
+
+	if ((cm_frames[index].cf_state & CF_ORDER) == 0 &&
+	    cm_frames[index].cf_as == NULL) {
+		cm_cache_put(index);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cm_release(index);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cm_frames[index].cf_refcount > 0);
+	KASSERT(cm_frames[index].cf_refcount < 0xffff);
+	cm_frames[index].cf_refcount++;
+	cm_frames[index].cf_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_decref(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+	unsigned left;
+	bool cache = false;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cm_frames[index].cf_refcount > 0);
+	left = --cm_frames[index].cf_refcount;
+	if (left == 0 && (cm_frames[index].cf_state & CF_ORDER) == 0) {
+		/* out of the clock's sight before we let go of the lock */
+		cm_frames[index].cf_as = NULL;
+		cache = true;
+	} else if (left == 0) {
+		cm_release(index);
+	}
+	spinlock_release(&coremap_lock);
+
+	if (cache) {
+		cm_cache_put(index);
+	}
+	return left;
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	return cm_frames[cm_headindex(paddr)].cf_refcount;
+}
+
+int
+coremap_owner(paddr_t paddr)
+{
+	return cm_frames[cm_headindex(paddr)].cf_owner;
+}
+
+void
+coremap_map(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned index = cm_headindex(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cm_frames[index].cf_owner == CM_USER);
+	KASSERT(as == NULL || cm_frames[index].cf_refcount == 1);
+	cm_frames[index].cf_as = as;
+	cm_frames[index].cf_vaddr = vaddr;
+	cm_frames[index].cf_flags |= CF_REF;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_reference(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	cm_frames[index].cf_flags |= CF_REF;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_testref(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+	bool ref;
+
+	spinlock_acquire(&coremap_lock);
+	ref = (cm_frames[index].cf_flags & CF_REF) != 0;
+	cm_frames[index].cf_flags &= ~CF_REF;
+	spinlock_release(&coremap_lock);
+	return ref;
+}
+
+/*
+ * Whether CF is a user frame with a recorded mapping that nobody is
+ * evicting: one coremap_victim and coremap_scan may hand out.
+ */
+static
+bool
+cm_mapped(struct cm_frame *cf)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if ((cf->cf_state & (CF_HEAD | CF_FREE)) != CF_HEAD ||
+	    cf->cf_owner != CM_USER || cf->cf_as == NULL ||
+	    (cf->cf_flags & CF_BUSY) != 0) {
+		return false;
+	}
+	KASSERT(cf->cf_refcount == 1);
+	return true;
+}
+
+/*
+ * Get hold of the as_lock of mapped frame CF's address space, without
+ * waiting: the mapping, and so the address space, can't go away while
+ * we hold coremap_lock. *LOCKEDP says whether we took it or already
+ * had it.
+ */
+static
+bool
+cm_lockas(struct cm_frame *cf, bool *lockedp)
+{
+	if (lock_do_i_hold(cf->cf_as->as_lock)) {
+		*lockedp = false;
+	} else if (lock_tryacquire(cf->cf_as->as_lock)) {
+		*lockedp = true;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+paddr_t
+coremap_victim(struct addrspace **asp, vaddr_t *vaddrp, bool *lockedp)
+{
+	struct cm_frame *cf;
+	unsigned n;
+
+	KASSERT(cm_loaded);
+
+	spinlock_acquire(&coremap_lock);
+
+	/* two sweeps: the first may only be clearing CF_REF */
+	for (n = 0; n < 2 * cm_nframes; n++) {
+		cf = &cm_frames[cm_clockhand];
+		cm_clockhand = (cm_clockhand + 1) % cm_nframes;
+
+		if (!cm_mapped(cf)) {
+			continue;
+		}
+
+		if (cf->cf_flags & CF_REF) {
+			/*
+			 * Second chance. Software-loaded TLBs have no
+			 * reference bit, so arrange to hear about the
+			 * next use through vm_fault.
+			 */
+			cf->cf_flags &= ~CF_REF;
+			as_unreference(cf->cf_as, cf->cf_vaddr);
+			continue;
+		}
+
+		/* never wait for another address space from in here */
+		if (!cm_lockas(cf, lockedp)) {
+			continue;
+		}
+
+		cf->cf_flags |= CF_BUSY;
+		*asp = cf->cf_as;
+		*vaddrp = cf->cf_vaddr;
+		spinlock_release(&coremap_lock);
+		return cm_base + (cf - cm_frames) * PAGE_SIZE;
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+paddr_t
+coremap_scan(unsigned *cursorp, struct addrspace **asp, vaddr_t *vaddrp,
+	     bool *lockedp)
+{
+	struct cm_frame *cf;
+
+	KASSERT(cm_loaded);
+
+	spinlock_acquire(&coremap_lock);
+	while (*cursorp < cm_nframes) {
+		cf = &cm_frames[(*cursorp)++];
+		if (cm_mapped(cf) && cm_lockas(cf, lockedp)) {
+			*asp = cf->cf_as;
+			*vaddrp = cf->cf_vaddr;
+			spinlock_release(&coremap_lock);
+			return cm_base + (cf - cm_frames) * PAGE_SIZE;
+		}
+	}
+	spinlock_release(&coremap_lock);
+	*cursorp = 0;
+	return 0;
+}
+
+bool
+coremap_lockmapping(paddr_t paddr, struct addrspace **asp, vaddr_t *vaddrp,
+		    bool *lockedp)
+{
+	struct cm_frame *cf;
+	bool ok = false;
+
+	KASSERT(cm_loaded);
+
+	if (paddr < cm_base || paddr >= cm_base + cm_nframes * PAGE_SIZE) {
+		return false;
+	}
+	cf = &cm_frames[(paddr - cm_base) / PAGE_SIZE];
+
+	spinlock_acquire(&coremap_lock);
+	if (cm_mapped(cf) && cm_lockas(cf, lockedp)) {
+		*asp = cf->cf_as;
+		*vaddrp = cf->cf_vaddr;
+		ok = true;
+	}
+	spinlock_release(&coremap_lock);
+	return ok;
+}
+
+void
+coremap_unbusy(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cm_frames[index].cf_flags & CF_BUSY);
+	cm_frames[index].cf_flags &= ~CF_BUSY;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setclean(paddr_t paddr, int slot)
+{
+	unsigned index = cm_headindex(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cm_frames[index].cf_owner == CM_USER);
+	cm_frames[index].cf_flags |= CF_CLEAN;
+	cm_frames[index].cf_slot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_getclean(paddr_t paddr, int *slotp)
+{
+	unsigned index = cm_headindex(paddr);
+	bool clean;
+
+	spinlock_acquire(&coremap_lock);
+	clean = (cm_frames[index].cf_flags & CF_CLEAN) != 0;
+	*slotp = clean ? cm_frames[index].cf_slot : -1;
+	spinlock_release(&coremap_lock);
+	return clean;
+}
+
+int
+coremap_setdirty(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+	int slot = -1;
+
+	spinlock_acquire(&coremap_lock);
+	if (cm_frames[index].cf_flags & CF_CLEAN) {
+		slot = cm_frames[index].cf_slot;
+		cm_frames[index].cf_flags &= ~CF_CLEAN;
+	}
+	spinlock_release(&coremap_lock);
+	return slot;
+}
+
+/*
+ * Fragmentation index of order ORDER, in thousandths, as Mel Gorman
+ * defines it: near 0 when an allocation that size fails for want of
+ * memory, near 1000 when it fails because what's free is in pieces
+ * too small. -1 if it wouldn't fail.
+ */
+static
+int
+cm_fragindex(unsigned order)
+{
+	unsigned k, nblocks;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	nblocks = 0;
+	for (k = 0; k <= CM_MAXORDER; k++) {
+		if (k >= order && cm_nfree[k] > 0) {
+			return -1;
+		}
+		nblocks += cm_nfree[k];
+	}
+	if (nblocks == 0) {
+		return 0;
+	}
+	return 1000 - (1000 + cm_owned[CM_FREE] * 1000 / (1U << order)) /
+		nblocks;
+}
+
+int
+coremap_fragindex(unsigned long npages)
+{
+	unsigned order;
+	int index;
+
+	order = cm_order(npages);
+	if (order > CM_MAXORDER) {
+		return 0;
+	}
+	spinlock_acquire(&coremap_lock);
+	index = cm_fragindex(order);
+	spinlock_release(&coremap_lock);
+	return index;
+}
+
+/*
+ * Whether the block of 2^ORDER frames at INDEX could be emptied: every
+ * frame in it is free, or a single frame holding a user page that's
+ * mapped once and could be moved. The number of those is in *MOVEP.
+ */
+static
+bool
+cm_movable(unsigned index, unsigned order, unsigned *movep)
+{
+	struct cm_frame *cf;
+	unsigned i;
+
+	*movep = 0;
+	for (i = index; i < index + (1U << order); ) {
+		cf = &cm_frames[i];
+		if ((cf->cf_state & (CF_FREE | CF_HEAD)) ==
+		    (CF_FREE | CF_HEAD)) {
+			i += 1U << (cf->cf_state & CF_ORDER);
+		} else if ((cf->cf_state & CF_ORDER) == 0 && cm_mapped(cf)) {
+			(*movep)++;
+			i++;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+paddr_t
+coremap_compact_begin(unsigned long npages)
+{
+	struct cm_frame *cf;
+	unsigned order, index, best, bestmove, nmove, i, k;
+
+	KASSERT(cm_loaded);
+
+	order = cm_order(npages);
+	if (order > CM_MAXORDER || order == 0) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cm_flush();
+
+	/* each page moved out needs a free frame elsewhere */
+	if (cm_owned[CM_FREE] < (1U << order)) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* the cheapest block to empty */
+	best = cm_nframes;
+	bestmove = (1U << order) + 1;
+	for (index = 0; index + (1U << order) <= cm_nframes;
+	     index += 1U << order) {
+		if (cm_movable(index, order, &nmove) && nmove < bestmove) {
+			best = index;
+			bestmove = nmove;
+		}
+	}
+	if (best == cm_nframes || bestmove == 0) {
+		/* nothing will do, or the flush already made a block */
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* keep the free parts for ourselves */
+	for (i = best; i < best + (1U << order); ) {
+		cf = &cm_frames[i];
+		if ((cf->cf_state & CF_FREE) == 0) {
+			i++;
+			continue;
+		}
+		k = cf->cf_state & CF_ORDER;
+		cm_unlink(i, k);
+		cf->cf_state = CF_HEAD | k;
+		cf->cf_owner = CM_KERNEL;
+		cf->cf_refcount = 1;
+		cf->cf_flags = CF_ISOLATED;
+		cf->cf_as = NULL;
+		cm_owned[CM_FREE] -= 1U << k;
+		cm_owned[CM_KERNEL] += 1U << k;
+		i += 1U << k;
+	}
+	spinlock_release(&coremap_lock);
+
+	return cm_base + best * PAGE_SIZE;
+}
+
+void
+coremap_isolate(paddr_t paddr)
+{
+	unsigned index = cm_headindex(paddr);
+	struct cm_frame *cf = &cm_frames[index];
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(cf->cf_owner == CM_USER && cf->cf_refcount == 1);
+	KASSERT((cf->cf_state & CF_ORDER) == 0);
+	cf->cf_owner = CM_KERNEL;
+	cf->cf_flags = CF_ISOLATED;
+	cf->cf_as = NULL;
+	cm_owned[CM_USER]--;
+	cm_owned[CM_KERNEL]++;
+	spinlock_release(&coremap_lock);
+}
+
+/* Whether CF heads a piece of a block being compacted. */
+static
+bool
+cm_isolated(struct cm_frame *cf)
+{
+	return (cf->cf_state & (CF_HEAD | CF_FREE)) == CF_HEAD &&
+		(cf->cf_flags & CF_ISOLATED) != 0;
+}
+
+paddr_t
+coremap_compact_end(paddr_t base, unsigned long npages, int owner)
+{
+	struct cm_frame *cf;
+	unsigned order, index, end, i, k;
+	bool whole;
+
+	KASSERT(owner > CM_FREE && owner < CM_ZERO);
+
+	order = cm_order(npages);
+	index = cm_headindex(base);
+	end = index + (1U << order);
+	KASSERT(index % (1U << order) == 0 && end <= cm_nframes);
+
+	spinlock_acquire(&coremap_lock);
+	whole = true;
+	for (i = index; i < end; i += 1U << k) {
+		cf = &cm_frames[i];
+		k = 0;
+		if (cm_isolated(cf)) {
+			k = cf->cf_state & CF_ORDER;
+		} else {
+			whole = false;
+		}
+	}
+
+	if (!whole) {
+		/* a page we couldn't move, or one that moved in */
+		for (i = index; i < end; i += 1U << k) {
+			cf = &cm_frames[i];
+			k = 0;
+			if (cm_isolated(cf)) {
+				k = cf->cf_state & CF_ORDER;
+				cm_release(i);
+			}
+		}
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* all ours: make the pieces one block */
+	for (i = index + 1; i < end; i++) {
+		cm_frames[i].cf_state = 0;
+		cm_frames[i].cf_flags = 0;
+	}
+	cf = &cm_frames[index];
+	cf->cf_state = CF_HEAD | order;
+	cf->cf_owner = owner;
+	cf->cf_refcount = 1;
+	cf->cf_flags = 0;
+	cm_owned[CM_KERNEL] -= 1U << order;
+	cm_owned[owner] += 1U << order;
+	spinlock_release(&coremap_lock);
+
+	return base;
+}
+
+void
+coremap_printstats(void)
+{
+	unsigned nfree[CM_MAXORDER + 1];
+	int frag[CM_MAXORDER + 1];
+	unsigned owned[CM_NOWNERS];
+	struct cm_pcpu *pc;
+	unsigned k, i, n;
+
+	/* copy out under the lock; kprintf may block */
+	spinlock_acquire(&coremap_lock);
+	for (k = 0; k <= CM_MAXORDER; k++) {
+		nfree[k] = cm_nfree[k];
+		frag[k] = cm_fragindex(k);
+	}
+	for (k = 0; k < CM_NOWNERS; k++) {
+		owned[k] = cm_owned[k];
+	}
+	for (i = 0; i < MAXCPUS; i++) {
+		for (k = 0; k < CM_NOWNERS; k++) {
+			owned[k] += cm_pcpu[i].pc_owned[k];
+		}
+	}
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u frames: %u free, %u kernel, %u user, "
+		"%u page table, %u compressed swap, %u zeroed, %u cached\n",
+		cm_nframes, owned[CM_FREE], owned[CM_KERNEL], owned[CM_USER],
+		owned[CM_PTABLE], owned[CM_ZSWAP], owned[CM_ZERO],
+		owned[CM_CACHED]);
+	for (k = 0; k <= CM_MAXORDER; k++) {
+		if (frag[k] < 0) {
+			kprintf("    order %2u (%5u pages): %u free blocks\n",
+				k, 1U << k, nfree[k]);
+		} else {
+			kprintf("    order %2u (%5u pages): %u free blocks, "
+				"fragmentation %d.%03d\n", k, 1U << k,
+				nfree[k], frag[k] / 1000, frag[k] % 1000);
+		}
+	}
+	/* each cpu's cache is its own business; these are near enough */
+	for (i = 0; i < MAXCPUS; i++) {
+		pc = &cm_pcpu[i];
+		n = pc->pc_hits + pc->pc_misses;
+		if (n == 0 && pc->pc_frees == 0) {
+			continue;
+		}
+		kprintf("    cpu%u cache: %u frames, %u/%u allocs hit (%u%%), "
+			"%u frees, %u drains\n", i, pc->pc_count,
+			pc->pc_hits, n, n ? pc->pc_hits * 100 / n : 0,
+			pc->pc_frees, pc->pc_drains);
+	}
+}
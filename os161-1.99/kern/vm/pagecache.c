@@ -0,0 +1,391 @@
+/*
+ * File page cache: one frame per cached (vnode, offset), shared by
+ * every mapping of it. See pagecache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <uw-vmstats.h>	/* for the writeback count */
+
+#define PC_NBUCKETS  64
+#define PC_HASH(vn, off) \
+	((((uintptr_t)(vn) >> 4) ^ (uintptr_t)((off) / PAGE_SIZE)) % PC_NBUCKETS)
+
+struct pcpage {
+	struct vnode *pp_vnode;
+	off_t pp_offset;
+	paddr_t pp_paddr;
+	bool pp_dirty;
+	struct pcpage *pp_next;	/* same bucket */
+};
+
+/*
+ * Held across the file I/O, so pages are read and written one at a
+ * time. Anything that allocates memory under it can end up in the
+ * evictor, which is why pagecache_evict only ever tries for it.
+ */
+static struct lock *pc_lock;
+static struct pcpage *pc_table[PC_NBUCKETS];
+static unsigned pc_hand;	/* bucket pagecache_evict looks in first */
+
+/*
+ * Pages pagecache_invalidate dropped while someone still had them
+ * mapped. Lookups don't see them; they're only here so their holders
+ * can give them back, and go once the cache's is the last reference.
+ */
+static struct pcpage *pc_stale;
+
+void
+pagecache_bootstrap(void)
+{
+	pc_lock = lock_create("pagecache");
+	if (pc_lock == NULL) {
+		panic("pagecache_bootstrap: out of memory\n");
+	}
+}
+
+static
+struct pcpage *
+pc_find(struct vnode *vn, off_t offset)
+{
+	struct pcpage *pp;
+
+	for (pp = pc_table[PC_HASH(vn, offset)]; pp != NULL; pp = pp->pp_next) {
+		if (pp->pp_vnode == vn && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the page of VN at OFFSET in frame PADDR, which a caller has
+ * mapped: the cached one, or a stale one (*STALEP) if it's been
+ * invalidated since.
+ */
+static
+struct pcpage *
+pc_findframe(struct vnode *vn, off_t offset, paddr_t paddr, bool *stalep)
+{
+	struct pcpage *pp;
+
+	pp = pc_find(vn, offset);
+	if (pp != NULL && pp->pp_paddr == paddr) {
+		*stalep = false;
+		return pp;
+	}
+	for (pp = pc_stale; pp != NULL; pp = pp->pp_next) {
+		if (pp->pp_vnode == vn && pp->pp_offset == offset &&
+		    pp->pp_paddr == paddr) {
+			*stalep = true;
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Let go of the stale pages nobody maps any more. Program text gives
+ * its frames back without telling us, so this is done whenever we're
+ * in here anyway.
+ */
+static
+void
+pc_reap(void)
+{
+	struct pcpage *pp, **ppp;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	ppp = &pc_stale;
+	while ((pp = *ppp) != NULL) {
+		if (coremap_refcount(pp->pp_paddr) > 1) {
+			ppp = &pp->pp_next;
+			continue;
+		}
+		*ppp = pp->pp_next;
+		coremap_decref(pp->pp_paddr);
+		VOP_DECREF(pp->pp_vnode);
+		kfree(pp);
+	}
+}
+
+/*
+ * Do the I/O for page PP, up to the current end of its file. On a
+ * write the dirty bit is left alone; only the callers know whether
+ * someone could still be writing the page.
+ */
+static
+int
+pc_io(struct pcpage *pp, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	size_t len;
+	int result;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	result = VOP_STAT(pp->pp_vnode, &st);
+	if (result) {
+		return result;
+	}
+	if (pp->pp_offset >= st.st_size) {
+		// nothing of the file here; the rest of the page is ours
+		return 0;
+	}
+	len = PAGE_SIZE;
+	if (st.st_size - pp->pp_offset < PAGE_SIZE) {
+		len = st.st_size - pp->pp_offset;
+	}
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pp->pp_paddr), len,
+		  pp->pp_offset, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(pp->pp_vnode, &ku);
+	} else {
+		result = VOP_WRITE(pp->pp_vnode, &ku);
+	}
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	if (result == 0 && rw == UIO_WRITE) {
+		vmstats_inc(VMSTAT_MMAP_FILE_WRITE);
+	}
+	return result;
+}
+
+int
+pagecache_get(struct vnode *vn, off_t offset, paddr_t *paddrp, bool *readp)
+{
+	struct pcpage *pp;
+	paddr_t paddr;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	lock_acquire(pc_lock);
+	pc_reap();
+
+	pp = pc_find(vn, offset);
+	if (pp != NULL) {
+		coremap_incref(pp->pp_paddr);
+		*paddrp = pp->pp_paddr;
+		*readp = false;
+		lock_release(pc_lock);
+		return 0;
+	}
+
+	pp = kmalloc(sizeof(struct pcpage));
+	if (pp == NULL) {
+		lock_release(pc_lock);
+		return ENOMEM;
+	}
+	paddr = getuserpage(true);
+	if (paddr == 0) {
+		kfree(pp);
+		lock_release(pc_lock);
+		return ENOMEM;
+	}
+
+	pp->pp_vnode = vn;
+	pp->pp_offset = offset;
+	pp->pp_paddr = paddr;
+	pp->pp_dirty = false;
+	result = pc_io(pp, UIO_READ);
+	if (result) {
+		coremap_decref(paddr);
+		kfree(pp);
+		lock_release(pc_lock);
+		return result;
+	}
+
+	VOP_INCREF(vn);
+	pp->pp_next = pc_table[PC_HASH(vn, offset)];
+	pc_table[PC_HASH(vn, offset)] = pp;
+
+	// one reference for the cache, one for the caller
+	coremap_incref(paddr);
+	*paddrp = paddr;
+	*readp = true;
+	lock_release(pc_lock);
+	return 0;
+}
+
+void
+pagecache_dirty(struct vnode *vn, off_t offset, paddr_t paddr)
+{
+	struct pcpage *pp;
+	bool stale;
+
+	lock_acquire(pc_lock);
+	pp = pc_findframe(vn, offset, paddr, &stale);
+	KASSERT(pp != NULL);
+	// a stale page is never written back, so it doesn't matter
+	pp->pp_dirty = true;
+	lock_release(pc_lock);
+}
+
+int
+pagecache_put(struct vnode *vn, off_t offset, paddr_t paddr)
+{
+	struct pcpage *pp;
+	bool stale;
+	int result = 0;
+
+	lock_acquire(pc_lock);
+	pp = pc_findframe(vn, offset, paddr, &stale);
+	KASSERT(pp != NULL);
+	// the file has changed under a stale page; don't undo that
+	if (pp->pp_dirty && !stale) {
+		result = pc_io(pp, UIO_WRITE);
+		// nobody else left to dirty it again?
+		if (result == 0 && coremap_refcount(paddr) == 2) {
+			pp->pp_dirty = false;
+		}
+	}
+	coremap_decref(paddr);
+	if (stale) {
+		pc_reap();
+	}
+	lock_release(pc_lock);
+	return result;
+}
+
+int
+pagecache_sync(struct vnode *vn)
+{
+	struct pcpage *pp;
+	unsigned i;
+	int result, ret = 0;
+
+	lock_acquire(pc_lock);
+	for (i = 0; i < PC_NBUCKETS; i++) {
+		for (pp = pc_table[i]; pp != NULL; pp = pp->pp_next) {
+			if (!pp->pp_dirty || (vn != NULL && pp->pp_vnode != vn)) {
+				continue;
+			}
+			result = pc_io(pp, UIO_WRITE);
+			if (result) {
+				if (ret == 0) {
+					ret = result;
+				}
+				continue;
+			}
+			if (coremap_refcount(pp->pp_paddr) == 1) {
+				pp->pp_dirty = false;
+			}
+		}
+	}
+	lock_release(pc_lock);
+	return ret;
+}
+
+void
+pagecache_invalidate(struct vnode *vn, off_t offset, off_t len)
+{
+	struct pcpage *pp, **ppp;
+	unsigned i;
+
+	// every page we have of a file holds a reference to it, so with
+	// only the caller's there's nothing to do; that also keeps us
+	// off devices (swap) and out of sfs_reclaim, under the biglock.
+	// Our own write-backs change nothing.
+	if (vn->vn_fs == NULL || vn->vn_refcount <= 1 || pc_lock == NULL ||
+	    lock_do_i_hold(pc_lock)) {
+		return;
+	}
+
+	lock_acquire(pc_lock);
+	for (i = 0; i < PC_NBUCKETS; i++) {
+		ppp = &pc_table[i];
+		while ((pp = *ppp) != NULL) {
+			if (pp->pp_vnode != vn ||
+			    pp->pp_offset + PAGE_SIZE <= offset ||
+			    (len != 0 && pp->pp_offset >= offset + len)) {
+				ppp = &pp->pp_next;
+				continue;
+			}
+			*ppp = pp->pp_next;
+			if (coremap_refcount(pp->pp_paddr) > 1 &&
+			    !vm_unmapfile(vn, pp->pp_offset, pp->pp_paddr,
+					  true)) {
+				// still mapped and busy: its holders keep
+				// the old frame, and give it back later
+				pp->pp_next = pc_stale;
+				pc_stale = pp;
+				continue;
+			}
+
+			// anyone left is program text, with a reference
+			// of its own
+			coremap_decref(pp->pp_paddr);
+			VOP_DECREF(pp->pp_vnode);
+			kfree(pp);
+		}
+	}
+	pc_reap();
+	lock_release(pc_lock);
+}
+
+int
+pagecache_evict(void)
+{
+	struct pcpage *pp, **ppp;
+	unsigned n, b;
+
+	// we might be here from inside our own I/O
+	if (pc_lock == NULL || !lock_tryacquire(pc_lock)) {
+		return ENOMEM;
+	}
+	pc_reap();
+
+	for (n = 0; n < PC_NBUCKETS; n++) {
+		b = (pc_hand + n) % PC_NBUCKETS;
+		for (ppp = &pc_table[b]; *ppp != NULL; ppp = &(*ppp)->pp_next) {
+			pp = *ppp;
+			if (coremap_refcount(pp->pp_paddr) > 1) {
+				// still mapped: a second chance if it's
+				// been used since we last came round
+				if (coremap_testref(pp->pp_paddr)) {
+					(void)vm_unmapfile(pp->pp_vnode,
+							   pp->pp_offset,
+							   pp->pp_paddr,
+							   false);
+					continue;
+				}
+				if (!vm_unmapfile(pp->pp_vnode, pp->pp_offset,
+						  pp->pp_paddr, true) ||
+				    coremap_refcount(pp->pp_paddr) > 1) {
+					// held other than through
+					// mmap: program text
+					continue;
+				}
+			}
+			// to the file, not to swap
+			if (pp->pp_dirty && pc_io(pp, UIO_WRITE) != 0) {
+				continue;
+			}
+
+			*ppp = pp->pp_next;
+			pc_hand = (b + 1) % PC_NBUCKETS;
+			coremap_decref(pp->pp_paddr);
+			VOP_DECREF(pp->pp_vnode);
+			kfree(pp);
+			lock_release(pc_lock);
+			return 0;
+		}
+	}
+
+	lock_release(pc_lock);
+	return ENOMEM;
+}
@@ -0,0 +1,194 @@
+/*
+ * Swap space management: a raw disk carved into page-sized slots,
+ * with a reference count per slot. Pages are offered to the
+ * compressed pool (zswap.c) first and only written to the disk if
+ * it won't take them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+static struct vnode *swap_vnode;	/* NULL if there's no swap */
+static uint16_t *swap_refs;		/* references to each slot */
+static unsigned swap_nslots;
+static unsigned swap_hint;		/* where to look for a free slot */
+
+/* slots to number compressed pages with when there's no disk */
+#define SWAP_MEMSLOTS  1024
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	strcpy(path, SWAP_DEVICE);	/* vfs_open mangles its argument */
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; compressed pages only\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		swap_nslots = SWAP_MEMSLOTS;
+	} else {
+		result = VOP_STAT(swap_vnode, &st);
+		if (result) {
+			panic("swap: stat %s: %s\n", SWAP_DEVICE,
+			      strerror(result));
+		}
+		swap_nslots = st.st_size / PAGE_SIZE;
+	}
+
+	swap_refs = kmalloc(swap_nslots * sizeof(uint16_t));
+	if (swap_refs == NULL) {
+		panic("swap: no memory for %u slots\n", swap_nslots);
+	}
+	bzero(swap_refs, swap_nslots * sizeof(uint16_t));
+	zswap_bootstrap(swap_nslots);
+
+	if (swap_vnode != NULL) {
+		kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+	}
+}
+
+/*
+ * Do a page of I/O between slot SLOT and the page at kernel address
+ * BUF. ENOSPC if there's no disk to do it with.
+ */
+static
+int
+swap_io(int slot, void *buf, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	uio_kinit(&iov, &ku, buf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	} else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+int
+swap_out(paddr_t paddr, int *slot)
+{
+	unsigned i, n;
+	int result;
+
+	spinlock_acquire(&swap_lock);
+	for (n = 0; n < swap_nslots; n++) {
+		i = (swap_hint + n) % swap_nslots;
+		if (swap_refs[i] == 0) {
+			break;
+		}
+	}
+	if (n == swap_nslots) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	swap_refs[i] = 1;
+	swap_hint = i + 1;
+	spinlock_release(&swap_lock);
+
+	// doesn't compress, or the pool is full of other sizes
+	result = zswap_store(i, paddr);
+	if (result) {
+		result = swap_write(i, (void *)PADDR_TO_KVADDR(paddr));
+	}
+	if (result) {
+		swap_decref(i);
+		return result;
+	}
+
+	*slot = i;
+	return 0;
+}
+
+int
+swap_write(int slot, const void *buf)
+{
+	int result;
+
+	KASSERT(slot >= 0 && (unsigned)slot < swap_nslots);
+
+	result = swap_io(slot, (void *)buf, UIO_WRITE);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	return result;
+}
+
+int
+swap_in(int slot, paddr_t paddr)
+{
+	int result;
+
+	KASSERT(slot >= 0 && (unsigned)slot < swap_nslots);
+	KASSERT(swap_refs[slot] > 0);
+
+	if (zswap_load(slot, paddr)) {
+		return 0;
+	}
+
+	result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), UIO_READ);
+	if (result) {
+		return result;
+	}
+
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	return 0;
+}
+
+void
+swap_incref(int slot)
+{
+	KASSERT(slot >= 0 && (unsigned)slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	KASSERT(swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_decref(int slot)
+{
+	KASSERT(slot >= 0 && (unsigned)slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	if (swap_refs[slot] == 1) {
+		// nobody else can take a reference to a slot that only
+		// we hold, so its compressed copy can go before it does
+		// and never be mistaken for the next page's
+		spinlock_release(&swap_lock);
+		zswap_drop(slot);
+		spinlock_acquire(&swap_lock);
+	}
+	swap_refs[slot]--;
+	spinlock_release(&swap_lock);
+}
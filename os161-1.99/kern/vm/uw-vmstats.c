@@ -5,7 +5,8 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines): by acquiring stats_lock,
+ * or for _vmstats_inc by having interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
  */
@@ -14,11 +15,21 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <uw-vmstats.h>
+#include <platform/maxcpus.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
+/* Counters for tracking statistics. Each cpu only ever increments its
+ * own row, with interrupts off, so increments need no lock; the rows
+ * are only added up when someone asks. A reset doesn't touch them
+ * either: it records the totals so far in stats_base, which later
+ * snapshots subtract.
+ */
+static unsigned int stats_counts[MAXCPUS][VMSTAT_COUNT];
+static unsigned int stats_base[VMSTAT_COUNT];
 
+/* Only for snapshots, resets and init; never on the increment path */
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
 /* Strings used in printing out the statistics */
@@ -33,6 +44,29 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "Address Space Switches",
+ /* 11 */ "ASID Rollovers",
+ /* 12 */ "Page Faults from Mapped Files",
+ /* 13 */ "Mapped File Writebacks",
+ /* 14 */ "Zero Pool Hits",
+ /* 15 */ "Zero Pool Misses",
+ /* 16 */ "TLB Shootdowns",
+ /* 17 */ "Pages Shot Down",
+ /* 18 */ "Shootdown IPIs",
+ /* 19 */ "Shootdown CPUs Skipped",
+ /* 20 */ "Shootdown Wait (usec)",
+ /* 21 */ "TLB Fault-Around Preloads",
+ /* 22 */ "Pages In Ahead of Use",
+ /* 23 */ "Clean Evictions (No Write)",
+ /* 24 */ "Pages Merged",
+ /* 25 */ "Pages Compressed",
+ /* 26 */ "Pages Too Big to Compress",
+ /* 27 */ "Compressed Swap Hits",
+ /* 28 */ "Compressed Bytes",
+ /* 29 */ "Compressed Writebacks",
+ /* 30 */ "Compactions",
+ /* 31 */ "Failed Compactions",
+ /* 32 */ "Pages Moved by Compaction",
 };
 
 
@@ -41,9 +75,47 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    int spl;
+
+    /* interrupts off: no migrating, and no handler on this cpu in between */
+    spl = splhigh();
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_add(unsigned int index, unsigned int amount)
+{
+    int spl;
+
+    KASSERT(index < VMSTAT_COUNT);
+    spl = splhigh();
+      stats_counts[curcpu->c_number][index] += amount;
+    splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_snapshot(unsigned int *counts, bool reset)
+{
+  unsigned int sum;
+  int i, c;
+
+  spinlock_acquire(&stats_lock);
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    sum = 0;
+    for (c=0; c<MAXCPUS; c++) {
+      sum += stats_counts[c][i];
+    }
+    counts[i] = sum - stats_base[i];
+    if (reset) {
+      stats_base[i] = sum;
+    }
+  }
+  spinlock_release(&stats_lock);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +137,7 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  stats_counts[curcpu->c_number][index]++;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -73,6 +145,7 @@ void
 _vmstats_init(void)
 {
   int i = 0;
+  int c = 0;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -81,27 +154,36 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    for (c=0; c<MAXCPUS; c++) {
+      stats_counts[c][i] = 0;
+    }
+    stats_base[i] = 0;
   }
 
 }
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
- * Just use this when there is only one thread remaining.
+/* NOTE: The spinlock is only held while taking the snapshot, because
+ * kprintf may block and we can't block while holding a spinlock.
+ * Counts still moving on other cpus may not add up exactly.
  */
 
 void
 vmstats_print(void)
 {
+  unsigned int stats_counts[VMSTAT_COUNT];
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  int prefetched = 0;
+  int swap_reads = 0;
+  int avg = 0;
+
+  vmstats_snapshot(stats_counts, false);
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -112,8 +194,11 @@ vmstats_print(void)
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
     stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ] +
+    stats_counts[VMSTAT_MMAP_FILE_READ] + stats_counts[VMSTAT_ZSWAP_HIT];
+  swap_reads = stats_counts[VMSTAT_SWAP_FILE_READ] + stats_counts[VMSTAT_ZSWAP_HIT];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  prefetched = stats_counts[VMSTAT_PAGE_PREFETCH];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -128,9 +213,60 @@ vmstats_print(void)
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
-  if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
+  /* with ASIDs, switching address spaces should cost few reloads */
+  if (stats_counts[VMSTAT_AS_SWITCH] > 0) {
+    kprintf("VMSTAT TLB Reloads per switch = %d.%02d\n",
+      stats_counts[VMSTAT_TLB_RELOAD] / stats_counts[VMSTAT_AS_SWITCH],
+      (stats_counts[VMSTAT_TLB_RELOAD] * 100 / stats_counts[VMSTAT_AS_SWITCH]) % 100);
+  }
+
+  /* fault-around turns would-be misses into preloads */
+  if (tlb_faults > 0) {
+    kprintf("VMSTAT TLB Reloads per TLB Fault = %d.%02d\n",
+      stats_counts[VMSTAT_TLB_RELOAD] / tlb_faults,
+      (stats_counts[VMSTAT_TLB_RELOAD] * 100 / tlb_faults) % 100);
+    kprintf("VMSTAT TLB Fault-Around Preloads per TLB Fault = %d.%02d\n",
+      stats_counts[VMSTAT_TLB_PRELOAD] / tlb_faults,
+      (stats_counts[VMSTAT_TLB_PRELOAD] * 100 / tlb_faults) % 100);
+  }
+
+  /* a batch of pages per IPI, and only to cpus that might have them */
+  if (stats_counts[VMSTAT_SHOOTDOWN] > 0) {
+    kprintf("VMSTAT Pages per shootdown = %d.%02d\n",
+      stats_counts[VMSTAT_SHOOTDOWN_PAGE] / stats_counts[VMSTAT_SHOOTDOWN],
+      (stats_counts[VMSTAT_SHOOTDOWN_PAGE] * 100 / stats_counts[VMSTAT_SHOOTDOWN]) % 100);
+    kprintf("VMSTAT Average shootdown latency = %d usec\n",
+      stats_counts[VMSTAT_SHOOTDOWN_USEC] / stats_counts[VMSTAT_SHOOTDOWN]);
+  }
+
+  /* what it costs to open up a contiguous block */
+  if (stats_counts[VMSTAT_COMPACT] + stats_counts[VMSTAT_COMPACT_FAIL] > 0) {
+    kprintf("VMSTAT Pages moved per compaction = %d.%02d\n",
+      stats_counts[VMSTAT_PAGE_MIGRATE] /
+        (stats_counts[VMSTAT_COMPACT] + stats_counts[VMSTAT_COMPACT_FAIL]),
+      (stats_counts[VMSTAT_PAGE_MIGRATE] * 100 /
+        (stats_counts[VMSTAT_COMPACT] + stats_counts[VMSTAT_COMPACT_FAIL])) % 100);
+  }
+
+  /* how much the compressed pool saves, and how much of swap it serves */
+  if (stats_counts[VMSTAT_ZSWAP_STORE] > 0) {
+    avg = stats_counts[VMSTAT_ZSWAP_BYTES] / stats_counts[VMSTAT_ZSWAP_STORE];
+    kprintf("VMSTAT Average compressed page = %d bytes\n", avg);
+    if (avg > 0) {
+      kprintf("VMSTAT Compression ratio = %d.%02d\n",
+        PAGE_SIZE / avg, (PAGE_SIZE * 100 / avg) % 100);
+    }
+  }
+  if (swap_reads > 0) {
+    kprintf("VMSTAT Compressed Swap Hits per swap in = %d%%\n",
+      stats_counts[VMSTAT_ZSWAP_HIT] * 100 / swap_reads);
+  }
+
+  /* read-ahead, madvise and mlock read pages without a fault */
+  kprintf("VMSTAT ELF File reads + Swapfile reads + Mapped File reads + Compressed Swap Hits = %d\n", elf_plus_swap_reads);
+  if (elf_plus_swap_reads < disk_reads ||
+      elf_plus_swap_reads > disk_reads + prefetched) {
+    kprintf("WARNING: ELF File reads + Swapfile reads + Mapped File reads + Compressed Swap Hits (%d) not between Page Faults (Disk) and Page Faults (Disk) + Pages In Ahead of Use\n",
       elf_plus_swap_reads);
   }
 }
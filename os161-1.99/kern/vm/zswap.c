@@ -0,0 +1,429 @@
+/*
+ * Compressed swap pool: evicted pages compressed into RAM ahead of
+ * the swap disk. See zswap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+/*
+ * The coder. Output is groups of up to eight items, each group led
+ * by a byte with a bit per item: 0 for a literal byte, 1 for a match
+ * of 3 or more bytes up to 4095 bytes back, coded in two bytes as the
+ * top four bits of the offset, the length less 3, and the rest of the
+ * offset. A length nibble of 15 is followed by a byte more of length,
+ * which LZRW1 doesn't have, so that runs of zeroes stay small.
+ * Matches are found through a hash of the next three bytes,
+ * remembering only the last place each hash was seen.
+ */
+#define ZS_MINMATCH  3
+#define ZS_LONGMATCH (ZS_MINMATCH + 15)
+#define ZS_MAXMATCH  (ZS_LONGMATCH + 255)
+#define ZS_MAXOFF    4095
+#define ZS_HASHBITS  12
+#define ZS_HASH(p) \
+	((40543U * ((((p)[0] << 4) ^ (p)[1]) << 4 ^ (p)[2]) >> 4) & \
+	 ((1 << ZS_HASHBITS) - 1))
+
+/*
+ * The pool. Each pool frame holds chunks of a single size class; a
+ * page goes in the smallest class that fits it compressed.
+ */
+#define ZS_NCLASSES  4
+#define ZS_CLASS(c)  (256U << (c))		/* 256 to 2048 bytes */
+#define ZS_MAXLEN    ZS_CLASS(ZS_NCLASSES - 1)
+#define ZS_MAXFRAMES 64			/* most frames the pool takes (256K) */
+
+struct zsframe {
+	paddr_t zf_paddr;	/* 0 if the descriptor is free */
+	unsigned zf_class;
+	uint16_t zf_used;	/* bit per chunk */
+};
+
+/* what we have for each swap slot */
+#define ZE_NONE  (-1)		/* nothing; the page is on disk, if anywhere */
+#define ZE_SAME  (-2)		/* one word repeated; ze_word is the word */
+
+struct zsentry {
+	int ze_frame;		/* pool frame, or ZE_NONE or ZE_SAME */
+	uint32_t ze_word;	/* chunk in the frame, or the fill word */
+	uint16_t ze_len;	/* compressed length */
+	int ze_older;		/* neighbours in the pool's FIFO, or -1 */
+	int ze_newer;
+};
+
+/*
+ * Covers everything below, the static buffers included. Loads and
+ * drops never allocate or do I/O under it, so a writeback holding it
+ * across a disk write can't wait on anyone who's waiting for it.
+ */
+static struct lock *zs_lock;
+static struct zsentry *zs_entries;
+static unsigned zs_nslots;
+static struct zsframe zs_frames[ZS_MAXFRAMES];
+static int zs_oldest = -1, zs_newest = -1;	/* slots, in order stored */
+
+static uint16_t zs_hash[1 << ZS_HASHBITS];
+static uint8_t zs_buf[ZS_MAXLEN];		/* a page, compressed */
+static uint32_t zs_page[PAGE_SIZE / sizeof(uint32_t)];	/* for writeback */
+
+void
+zswap_bootstrap(unsigned nslots)
+{
+	unsigned i;
+
+	zs_lock = lock_create("zswap");
+	zs_entries = kmalloc(nslots * sizeof(struct zsentry));
+	if (zs_lock == NULL || zs_entries == NULL) {
+		panic("zswap: no memory for %u slots\n", nslots);
+	}
+	for (i = 0; i < nslots; i++) {
+		zs_entries[i].ze_frame = ZE_NONE;
+	}
+	zs_nslots = nslots;
+}
+
+/*
+ * Compress the page at SRC into DST. Returns the compressed length,
+ * or 0 if it would come to more than MAX bytes.
+ */
+static
+size_t
+zs_compress(const uint8_t *src, uint8_t *dst, size_t max)
+{
+	const uint8_t *p, *cand, *end;
+	uint8_t *q, *ctl;
+	unsigned bit, h, len;
+	size_t off;
+
+	end = src + PAGE_SIZE;
+	ctl = NULL;
+	bit = 8;
+	q = dst;
+	for (p = src; p < end; bit++) {
+		// room for a new group's byte and a long match
+		if (q + 4 > dst + max) {
+			return 0;
+		}
+		if (bit == 8) {
+			ctl = q++;
+			*ctl = 0;
+			bit = 0;
+		}
+
+		len = 0;
+		off = 0;
+		if (end - p >= ZS_MINMATCH) {
+			h = ZS_HASH(p);
+			// stale entries from earlier pages are caught below
+			cand = src + zs_hash[h];
+			zs_hash[h] = p - src;
+			off = p - cand;
+			if (cand < p && off <= ZS_MAXOFF) {
+				while (len < ZS_MAXMATCH && p + len < end &&
+				       cand[len] == p[len]) {
+					len++;
+				}
+			}
+		}
+
+		if (len >= ZS_MINMATCH) {
+			*ctl |= 1 << bit;
+			p += len;
+			if (len >= ZS_LONGMATCH) {
+				*q++ = (off >> 8) << 4 | 15;
+				*q++ = off & 0xff;
+				*q++ = len - ZS_LONGMATCH;
+			} else {
+				*q++ = (off >> 8) << 4 | (len - ZS_MINMATCH);
+				*q++ = off & 0xff;
+			}
+		} else {
+			*q++ = *p++;
+		}
+	}
+	return q - dst;
+}
+
+/* Undo zs_compress: LEN bytes at SRC make a page at DST. */
+static
+void
+zs_decompress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+	const uint8_t *end;
+	uint8_t *q, ctl;
+	unsigned bit, off, n;
+
+	end = src + len;
+	ctl = 0;
+	bit = 8;
+	for (q = dst; src < end; bit++) {
+		if (bit == 8) {
+			ctl = *src++;
+			bit = 0;
+		}
+		if (ctl & (1 << bit)) {
+			off = (src[0] >> 4) << 8 | src[1];
+			n = (src[0] & 0xf) + ZS_MINMATCH;
+			src += 2;
+			if (n == ZS_LONGMATCH) {
+				n += *src++;
+			}
+			KASSERT(off > 0 && off <= (unsigned)(q - dst));
+			// may overlap what it's making; byte at a time
+			for (; n > 0; n--, q++) {
+				*q = *(q - off);
+			}
+		} else {
+			*q++ = *src++;
+		}
+	}
+	KASSERT(q == dst + PAGE_SIZE);
+}
+
+static
+void *
+zs_chunk(int f, unsigned chunk)
+{
+	return (void *)(PADDR_TO_KVADDR(zs_frames[f].zf_paddr) +
+			chunk * ZS_CLASS(zs_frames[f].zf_class));
+}
+
+/* Give back chunk CHUNK of pool frame F, and the frame if it's empty. */
+static
+void
+zs_chunk_free(int f, unsigned chunk)
+{
+	struct zsframe *zf = &zs_frames[f];
+
+	KASSERT(zf->zf_used & (1 << chunk));
+	zf->zf_used &= ~(1 << chunk);
+	if (zf->zf_used == 0) {
+		coremap_free(zf->zf_paddr);
+		zf->zf_paddr = 0;
+	}
+}
+
+/* Take SLOT's page out of the FIFO and give back its chunk. */
+static
+void
+zs_remove(int slot)
+{
+	struct zsentry *ze = &zs_entries[slot];
+
+	KASSERT(ze->ze_frame >= 0);
+	if (ze->ze_older >= 0) {
+		zs_entries[ze->ze_older].ze_newer = ze->ze_newer;
+	} else {
+		zs_oldest = ze->ze_newer;
+	}
+	if (ze->ze_newer >= 0) {
+		zs_entries[ze->ze_newer].ze_older = ze->ze_older;
+	} else {
+		zs_newest = ze->ze_older;
+	}
+	zs_chunk_free(ze->ze_frame, ze->ze_word);
+	ze->ze_frame = ZE_NONE;
+}
+
+/*
+ * Make room for a page of class C by writing the oldest such page
+ * out to its slot on disk.
+ */
+static
+int
+zs_writeback(unsigned c)
+{
+	struct zsentry *ze;
+	int slot, result;
+
+	for (slot = zs_oldest; slot >= 0; slot = ze->ze_newer) {
+		ze = &zs_entries[slot];
+		if (zs_frames[ze->ze_frame].zf_class == c) {
+			break;
+		}
+	}
+	if (slot < 0) {
+		// the pool is all other sizes; not worth emptying for one
+		return ENOSPC;
+	}
+
+	zs_decompress(zs_chunk(ze->ze_frame, ze->ze_word), ze->ze_len,
+		      (uint8_t *)zs_page);
+	result = swap_write(slot, zs_page);
+	if (result) {
+		return result;
+	}
+	vmstats_inc(VMSTAT_ZSWAP_WRITEBACK);
+	zs_remove(slot);
+	return 0;
+}
+
+/*
+ * Find a free chunk of class C, taking another frame for the pool
+ * or writing a page back to disk if need be.
+ */
+static
+int
+zs_chunk_alloc(unsigned c, int *fp, unsigned *chunkp)
+{
+	struct zsframe *zf;
+	unsigned chunk, nchunks;
+	int f, spare, result;
+
+	nchunks = PAGE_SIZE / ZS_CLASS(c);
+	for (;;) {
+		spare = -1;
+		for (f = 0; f < ZS_MAXFRAMES; f++) {
+			zf = &zs_frames[f];
+			if (zf->zf_paddr == 0) {
+				spare = f;
+				continue;
+			}
+			if (zf->zf_class != c) {
+				continue;
+			}
+			for (chunk = 0; chunk < nchunks; chunk++) {
+				if ((zf->zf_used & (1 << chunk)) == 0) {
+					zf->zf_used |= 1 << chunk;
+					*fp = f;
+					*chunkp = chunk;
+					return 0;
+				}
+			}
+		}
+
+		// never evict for it: we're the evictor
+		if (spare >= 0) {
+			zf = &zs_frames[spare];
+			zf->zf_paddr = coremap_alloc(1, CM_ZSWAP);
+			if (zf->zf_paddr != 0) {
+				zf->zf_class = c;
+				zf->zf_used = 1;
+				*fp = spare;
+				*chunkp = 0;
+				return 0;
+			}
+		}
+
+		result = zs_writeback(c);
+		if (result) {
+			return result;
+		}
+	}
+}
+
+int
+zswap_store(int slot, paddr_t paddr)
+{
+	const uint32_t *words;
+	struct zsentry *ze;
+	size_t len;
+	unsigned i, c, chunk;
+	int f, result;
+
+	KASSERT(slot >= 0 && (unsigned)slot < zs_nslots);
+
+	lock_acquire(zs_lock);
+	ze = &zs_entries[slot];
+	KASSERT(ze->ze_frame == ZE_NONE);
+
+	// all zeroes, mostly
+	words = (const uint32_t *)PADDR_TO_KVADDR(paddr);
+	for (i = 1; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (words[i] != words[0]) {
+			break;
+		}
+	}
+	if (i == PAGE_SIZE / sizeof(uint32_t)) {
+		ze->ze_frame = ZE_SAME;
+		ze->ze_word = words[0];
+		len = sizeof(uint32_t);
+		goto stored;
+	}
+
+	len = zs_compress((const uint8_t *)words, zs_buf, ZS_MAXLEN);
+	if (len == 0) {
+		lock_release(zs_lock);
+		vmstats_inc(VMSTAT_ZSWAP_REJECT);
+		return E2BIG;
+	}
+	for (c = 0; ZS_CLASS(c) < len; c++);
+
+	result = zs_chunk_alloc(c, &f, &chunk);
+	if (result) {
+		lock_release(zs_lock);
+		return result;
+	}
+	memcpy(zs_chunk(f, chunk), zs_buf, len);
+	ze->ze_frame = f;
+	ze->ze_word = chunk;
+	ze->ze_len = len;
+
+	ze->ze_older = zs_newest;
+	ze->ze_newer = -1;
+	if (zs_newest >= 0) {
+		zs_entries[zs_newest].ze_newer = slot;
+	} else {
+		zs_oldest = slot;
+	}
+	zs_newest = slot;
+
+ stored:
+	lock_release(zs_lock);
+	vmstats_inc(VMSTAT_ZSWAP_STORE);
+	vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+	return 0;
+}
+
+bool
+zswap_load(int slot, paddr_t paddr)
+{
+	struct zsentry *ze;
+	uint32_t *words;
+	unsigned i;
+
+	KASSERT(slot >= 0 && (unsigned)slot < zs_nslots);
+
+	lock_acquire(zs_lock);
+	ze = &zs_entries[slot];
+	words = (uint32_t *)PADDR_TO_KVADDR(paddr);
+	if (ze->ze_frame == ZE_NONE) {
+		lock_release(zs_lock);
+		return false;
+	} else if (ze->ze_frame == ZE_SAME) {
+		for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+			words[i] = ze->ze_word;
+		}
+	} else {
+		zs_decompress(zs_chunk(ze->ze_frame, ze->ze_word),
+			      ze->ze_len, (uint8_t *)words);
+	}
+	lock_release(zs_lock);
+
+	vmstats_inc(VMSTAT_ZSWAP_HIT);
+	return true;
+}
+
+void
+zswap_drop(int slot)
+{
+	struct zsentry *ze;
+
+	KASSERT(slot >= 0 && (unsigned)slot < zs_nslots);
+
+	lock_acquire(zs_lock);
+	ze = &zs_entries[slot];
+	if (ze->ze_frame >= 0) {
+		zs_remove(slot);
+	}
+	ze->ze_frame = ZE_NONE;
+	lock_release(zs_lock);
+}
@@ -39,9 +39,11 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* needs struct timeval from kern/time.h */
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -147,6 +149,16 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(int change);
+void *mmap(size_t length, int prot, off_t offset, const char *path);
+int munmap(void *addr, size_t length);
+int mprotect(void *addr, size_t length, int prot);
+int madvise(void *addr, size_t length, int advice);
+int mincore(void *addr, size_t length, unsigned char *vec);
+int mlock(const void *addr, size_t length);
+int munlock(const void *addr, size_t length);
+int getrlimit(int resource, struct rlimit *rlp);	/* RLIMIT_RSS only */
+int setrlimit(int resource, const struct rlimit *rlp);
+int __vmstat(unsigned *counts, unsigned ncounts, int reset); /* kern/vmstats.h */
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mincoretest.c
+ *
+ * 	Checks what mincore says about pages as they come and go.
+ *
+ * Pages never touched aren't in core; touched ones are. madvise
+ * (MADV_DONTNEED) takes pages out, and they read back as zeros,
+ * while the rest keep what was written. Pages locked with mlock
+ * can't be dropped until they're unlocked again.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define PageSize	4096
+#define NPAGES		16
+
+static char buf[(NPAGES + 1) * PageSize];
+static char *pages;
+
+static
+void
+incore(unsigned from, unsigned to, unsigned char expect)
+{
+	unsigned char vec[NPAGES];
+	unsigned i;
+
+	if (mincore(pages, NPAGES * PageSize, vec) < 0) {
+		err(1, "mincore");
+	}
+	for (i = from; i < to; i++) {
+		if (vec[i] != expect) {
+			errx(1, "page %u: mincore says %u, expected %u",
+			     i, vec[i], expect);
+		}
+	}
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	pages = (char *)(((uintptr_t)buf + PageSize - 1) & ~(PageSize - 1));
+
+	incore(0, NPAGES, 0);
+	for (i = 0; i < NPAGES; i++) {
+		pages[i * PageSize] = i + 1;
+	}
+	incore(0, NPAGES, 1);
+
+	/* drop the second half */
+	if (madvise(pages + NPAGES / 2 * PageSize, NPAGES / 2 * PageSize,
+		    MADV_DONTNEED) < 0) {
+		err(1, "madvise");
+	}
+	incore(0, NPAGES / 2, 1);
+	incore(NPAGES / 2, NPAGES, 0);
+	for (i = 0; i < NPAGES; i++) {
+		if (pages[i * PageSize] != (i < NPAGES / 2 ? (char)(i + 1) : 0)) {
+			errx(1, "page %u reads back %d", i,
+			     pages[i * PageSize]);
+		}
+	}
+
+	/* locked pages stay */
+	if (mlock(pages, PageSize) < 0) {
+		err(1, "mlock");
+	}
+	if (madvise(pages, PageSize, MADV_DONTNEED) != -1 ||
+	    errno != EINVAL) {
+		errx(1, "madvise dropped a locked page");
+	}
+	incore(0, 1, 1);
+	if (munlock(pages, PageSize) < 0) {
+		err(1, "munlock");
+	}
+	if (madvise(pages, PageSize, MADV_DONTNEED) < 0) {
+		err(1, "madvise after munlock");
+	}
+	incore(0, 1, 0);
+
+	printf("mincoretest: passed\n");
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmaptest.c
+ *
+ * 	Checks that stores through a shared file mapping reach the file.
+ *
+ * Userland can't create files here, so the file to use is named on
+ * the command line (default below). It must exist and be at least two
+ * pages long; what was in it is put back at the end.
+ *
+ * A child process writes a pattern through a mapping of the file,
+ * unmaps it and exits. The parent then maps the file again, whole and
+ * from an offset, and checks the pattern is there. Finally it stores
+ * through a mapping that stays mapped, syncs, and checks a second
+ * mapping of the same file sees the stores.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PageSize	4096
+#define NPAGES		2
+#define LEN		(NPAGES * PageSize)
+
+#define DEFAULT_FILE	"mmaptest.dat"
+
+static char saved[LEN];
+
+static
+unsigned char
+pattern(unsigned i, unsigned seed)
+{
+	return (i * 7 + seed) & 0xff;
+}
+
+static
+char *
+map(const char *path, size_t len, int prot, off_t offset)
+{
+	void *p;
+
+	p = mmap(len, prot, offset, path);
+	if (p == (void *)-1) {
+		err(1, "mmap %s", path);
+	}
+	return p;
+}
+
+static
+void
+unmap(void *p, size_t len)
+{
+	if (munmap(p, len) < 0) {
+		err(1, "munmap");
+	}
+}
+
+static
+void
+check(const char *what, const char *p, unsigned from, unsigned to,
+      unsigned seed)
+{
+	unsigned i;
+
+	for (i = from; i < to; i++) {
+		if ((unsigned char)p[i - from] != pattern(i, seed)) {
+			errx(1, "%s: byte %u is %u, expected %u", what, i,
+			     (unsigned char)p[i - from], pattern(i, seed));
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = DEFAULT_FILE;
+	char *p, *q;
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	if (argc > 1) {
+		path = argv[1];
+	}
+
+	p = map(path, LEN, PROT_READ | PROT_WRITE, 0);
+	memcpy(saved, p, LEN);
+	unmap(p, LEN);
+
+	/* the child's stores must outlive the child */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		p = map(path, LEN, PROT_READ | PROT_WRITE, 0);
+		for (i = 0; i < LEN; i++) {
+			p[i] = pattern(i, 3);
+		}
+		unmap(p, LEN);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	p = map(path, LEN, PROT_READ, 0);
+	check("after munmap", p, 0, LEN, 3);
+	unmap(p, LEN);
+
+	p = map(path, PageSize, PROT_READ, PageSize);
+	check("at an offset", p, PageSize, LEN, 3);
+	unmap(p, PageSize);
+
+	/* sync gets stores out without unmapping */
+	p = map(path, LEN, PROT_READ | PROT_WRITE, 0);
+	for (i = 0; i < LEN; i++) {
+		p[i] = pattern(i, 11);
+	}
+	if (sync() < 0) {
+		err(1, "sync");
+	}
+	q = map(path, LEN, PROT_READ, 0);
+	check("after sync", q, 0, LEN, 11);
+	unmap(q, LEN);
+
+	memcpy(p, saved, LEN);
+	unmap(p, LEN);
+
+	printf("mmaptest: passed\n");
+	return 0;
+}
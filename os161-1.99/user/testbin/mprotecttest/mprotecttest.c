@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mprotecttest.c
+ *
+ * 	Takes write access away from a page and writes to it anyway.
+ *
+ * Bad arguments are checked first, then a page is made read-only and
+ * read; the write after that should get the program killed, without
+ * the kernel panicking.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define PageSize	4096
+
+static char buf[2 * PageSize];
+
+static
+void
+expect(int result, int error, const char *what)
+{
+	if (result != -1 || errno != error) {
+		errx(1, "%s: expected error %d, got %d (errno %d)",
+		     what, error, result, errno);
+	}
+}
+
+int
+main(void)
+{
+	volatile char *page;
+	volatile char c;
+
+	page = (char *)(((uintptr_t)buf + PageSize - 1) & ~(PageSize - 1));
+	page[0] = 'a';
+
+	expect(mprotect((char *)page + 1, PageSize, PROT_READ),
+	       EINVAL, "unaligned");
+	expect(mprotect((char *)page, PageSize, 8), EINVAL, "bad prot");
+	expect(mprotect((void *)0x40000000, PageSize, PROT_READ),
+	       ENOMEM, "unmapped");
+
+	if (mprotect((char *)page, PageSize, PROT_READ) < 0) {
+		err(1, "mprotect");
+	}
+	c = page[0];
+	if (c != 'a') {
+		errx(1, "read-only page reads back %c", c);
+	}
+
+	printf("\nmprotecttest: writing a read-only page - I should die "
+	       "immediately\n");
+	page[0] = 'b';
+	printf("I didn't get killed!  Program has a bug\n");
+	return 1;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rsstest.c
+ *
+ * 	Checks that a resident set limit (RLIMIT_RSS) holds under load.
+ *
+ * Sets a small limit, then writes to many more pages than that, like
+ * hog but with memory, and checks with mincore that no more than the
+ * limit are ever in core, that a page locked with mlock stays, and
+ * that everything pushed out comes back intact. The kernel needs
+ * swap, or room in its compressed swap pool, for this to pass.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <kern/vmstats.h>
+
+#define PageSize	4096
+#define LIMIT		32		/* pages */
+#define NPAGES		256
+
+static char buf[(NPAGES + 1) * PageSize];
+static char *pages;
+
+static
+unsigned
+incore(void)
+{
+	static unsigned char vec[NPAGES];
+	unsigned i, n;
+
+	if (mincore(pages, NPAGES * PageSize, vec) < 0) {
+		err(1, "mincore");
+	}
+	if (vec[0] == 0) {
+		errx(1, "the locked page was pushed out");
+	}
+	for (i = n = 0; i < NPAGES; i++) {
+		n += vec[i];
+	}
+	return n;
+}
+
+static
+void
+limits(void)
+{
+	struct rlimit rl;
+
+	rl.rlim_cur = 2 * PageSize;
+	rl.rlim_max = PageSize;
+	if (setrlimit(RLIMIT_RSS, &rl) != -1 || errno != EINVAL) {
+		errx(1, "setrlimit allowed more than the maximum");
+	}
+	rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_NOFILE, &rl) != -1 || errno != EINVAL) {
+		errx(1, "setrlimit took an unsupported limit");
+	}
+
+	rl.rlim_cur = LIMIT * PageSize;
+	rl.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_RSS, &rl) < 0) {
+		err(1, "setrlimit");
+	}
+	if (getrlimit(RLIMIT_RSS, &rl) < 0) {
+		err(1, "getrlimit");
+	}
+	if (rl.rlim_cur != LIMIT * PageSize) {
+		errx(1, "getrlimit says %lu bytes, not %u",
+		     (unsigned long)rl.rlim_cur, LIMIT * PageSize);
+	}
+}
+
+int
+main(void)
+{
+	unsigned counts[VMSTAT_COUNT];
+	unsigned i, n, max, faults;
+	int ncounts;
+
+	pages = (char *)(((uintptr_t)buf + PageSize - 1) & ~(PageSize - 1));
+
+	ncounts = __vmstat(NULL, 0, 0);
+	if (ncounts != VMSTAT_COUNT) {
+		errx(1, "__vmstat has %d counters, expected %d",
+		     ncounts, VMSTAT_COUNT);
+	}
+	__vmstat(counts, VMSTAT_COUNT, 0);
+	faults = counts[VMSTAT_TLB_FAULT];
+
+	limits();
+
+	pages[0] = 1;
+	if (mlock(pages, PageSize) < 0) {
+		err(1, "mlock");
+	}
+
+	max = 0;
+	for (i = 1; i < NPAGES; i++) {
+		pages[i * PageSize] = i & 0xff;
+		n = incore();
+		if (n > max) {
+			max = n;
+		}
+	}
+	if (max > LIMIT) {
+		errx(1, "%u pages in core with a limit of %u", max, LIMIT);
+	}
+
+	for (i = 1; i < NPAGES; i++) {
+		if (pages[i * PageSize] != (char)(i & 0xff)) {
+			errx(1, "page %u came back wrong", i);
+		}
+		if (pages[0] != 1) {
+			errx(1, "the locked page changed");
+		}
+	}
+
+	__vmstat(counts, VMSTAT_COUNT, 0);
+	printf("rsstest: passed, at most %u of %u pages in core, "
+	       "%u TLB faults\n", max, NPAGES,
+	       counts[VMSTAT_TLB_FAULT] - faults);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tlbfaulter.c
+ *
+ * 	Measures what a TLB miss costs as the working set grows.
+ *
+ * Sweeps over a growing number of pages, touching one word in each,
+ * and reports the time per access and how many of the misses got as
+ * far as vm_fault. Up to the size of the TLB (64 entries, less the
+ * few taken by code and stack) the pages should stay in it and cost
+ * nothing; past that every access misses, and the time per access
+ * should then stay flat however full the TLB is.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <kern/vmstats.h>
+
+#define PageSize	4096
+#define MAXPAGES	512
+
+/* accesses timed at each size */
+#define ACCESSES	16384
+
+static const unsigned sizes[] = {
+	8, 16, 32, 48, 56, 60, 64, 72, 96, 128, 256, MAXPAGES,
+};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static char pages[MAXPAGES * PageSize];
+
+static
+unsigned
+tlbfaults(void)
+{
+	unsigned counts[VMSTAT_TLB_FAULT + 1];
+
+	if (__vmstat(counts, VMSTAT_TLB_FAULT + 1, 0) < 0) {
+		err(1, "__vmstat");
+	}
+	return counts[VMSTAT_TLB_FAULT];
+}
+
+static
+void
+sweep(unsigned npages, unsigned rounds)
+{
+	volatile char *p;
+	unsigned r, i;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < npages; i++) {
+			p = &pages[i * PageSize];
+			(void)*p;
+		}
+	}
+}
+
+int
+main(void)
+{
+	time_t secs, secs2;
+	unsigned long nsecs, nsecs2, usecs;
+	unsigned i, npages, rounds, faults;
+
+	/* bring everything in first, so we time misses and not zeroing */
+	for (i = 0; i < MAXPAGES; i++) {
+		pages[i * PageSize] = 1;
+	}
+
+	printf("pages  ns/access  vm_faults/access\n");
+	for (i = 0; i < NSIZES; i++) {
+		npages = sizes[i];
+		rounds = ACCESSES / npages;
+
+		sweep(npages, 1);
+		faults = tlbfaults();
+		__time(&secs, &nsecs);
+		sweep(npages, rounds);
+		__time(&secs2, &nsecs2);
+		faults = tlbfaults() - faults;
+
+		usecs = (unsigned long)(secs2 - secs) * 1000000 +
+			nsecs2 / 1000 - nsecs / 1000;
+		printf("%5u  %9lu  %12u.%02u\n", npages,
+		       usecs * 1000 / (npages * rounds),
+		       faults / (npages * rounds),
+		       faults * 100 / (npages * rounds) % 100);
+	}
+	return 0;
+}